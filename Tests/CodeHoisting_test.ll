@@ -0,0 +1,69 @@
+; int decode(int *buf, int base, int idx, int op, int d) {
+;   int r;
+;   if (op) {
+;     int off = base + idx * 4;    // very busy at the exit of entry:
+;     r = buf[off] + 1;            // hoisted, both copies removed
+;   } else {
+;     int off = base + idx * 4;
+;     r = buf[off] - 1;
+;   }
+;   if (op > 3)
+;     r += d + 7;                  // -> computed only in the then arm, not very busy: kept
+;   else
+;     r -= 5;
+;   int q;
+;   if (d)
+;     q = 100 / d;                 // very busy, but may trap: kept
+;   else
+;     q = 100 / d;
+;   return r + q;
+; }
+;
+; -> "decode: 2 instructions removed (2 expressions hoisted, 4 copies replaced)"
+
+define dso_local i32 @decode(ptr noundef %buf, i32 noundef %base, i32 noundef %idx, i32 noundef %op, i32 noundef %d) #0 {
+entry:
+  %tobool = icmp ne i32 %op, 0
+  br i1 %tobool, label %if.then, label %if.else
+if.then:
+  %mul = mul nsw i32 %idx, 4
+  %add = add nsw i32 %base, %mul
+  %idxprom = sext i32 %add to i64
+  %arrayidx = getelementptr inbounds i32, ptr %buf, i64 %idxprom
+  %0 = load i32, ptr %arrayidx, align 4
+  %add1 = add nsw i32 %0, 1
+  br label %if.end
+if.else:
+  %mul2 = mul nsw i32 %idx, 4
+  %add3 = add i32 %base, %mul2
+  %idxprom4 = sext i32 %add3 to i64
+  %arrayidx5 = getelementptr inbounds i32, ptr %buf, i64 %idxprom4
+  %1 = load i32, ptr %arrayidx5, align 4
+  %sub = sub nsw i32 %1, 1
+  br label %if.end
+if.end:
+  %r = phi i32 [ %add1, %if.then ], [ %sub, %if.else ]
+  %cmp = icmp sgt i32 %op, 3
+  br i1 %cmp, label %if.then6, label %if.else7
+if.then6:
+  %add8 = add nsw i32 %d, 7
+  %add9 = add nsw i32 %r, %add8
+  br label %if.end10
+if.else7:
+  %sub11 = sub nsw i32 %r, 5
+  br label %if.end10
+if.end10:
+  %r2 = phi i32 [ %add9, %if.then6 ], [ %sub11, %if.else7 ]
+  %tobool12 = icmp ne i32 %d, 0
+  br i1 %tobool12, label %if.then13, label %if.else14
+if.then13:
+  %div = sdiv i32 100, %d
+  br label %if.end15
+if.else14:
+  %div16 = sdiv i32 100, %d
+  br label %if.end15
+if.end15:
+  %q = phi i32 [ %div, %if.then13 ], [ %div16, %if.else14 ]
+  %add17 = add nsw i32 %r2, %q
+  ret i32 %add17
+}
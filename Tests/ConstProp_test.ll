@@ -0,0 +1,57 @@
+; int test_constprop(int a) {
+;   int k = 2 + 3;
+;   int p;
+;   if (k == 5)                // always taken: the else block is deleted
+;     p = k * 2;
+;   else
+;     p = a + 1;
+;   int x = 1;
+;   for (int i = 0; i < a; i++)
+;     if (x != 1)              // never taken: x stays 1 through the phis of the loop
+;       x = x + 100;
+;   int r = p + x;             // r = 11
+;   switch (r) {               // folded to the case 11
+;     case 11: return r;       // -> return 11
+;     case 12: return 0;
+;     default: return -1;
+;   }
+; }
+
+define dso_local i32 @test_constprop(i32 noundef %a) #0 {
+entry:
+  %k = add i32 2, 3
+  %c = icmp eq i32 %k, 5
+  br i1 %c, label %then, label %else
+then:
+  %m = mul i32 %k, 2
+  br label %join
+else:
+  %n = add i32 %a, 1
+  br label %join
+join:
+  %p = phi i32 [ %m, %then ], [ %n, %else ]
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %join ], [ %i2, %latch ]
+  %x = phi i32 [ 1, %join ], [ %x2, %latch ]
+  %t = icmp eq i32 %x, 1
+  br i1 %t, label %latch, label %never
+never:
+  %y = add i32 %x, 100
+  br label %latch
+latch:
+  %x2 = phi i32 [ %x, %loop ], [ %y, %never ]
+  %i2 = add i32 %i, 1
+  %d = icmp slt i32 %i2, %a
+  br i1 %d, label %loop, label %exit
+exit:
+  %r = add i32 %p, %x2
+  switch i32 %r, label %def [ i32 11, label %s11
+                               i32 12, label %s12 ]
+s11:
+  ret i32 %r
+s12:
+  ret i32 0
+def:
+  ret i32 -1
+}
@@ -0,0 +1,52 @@
+; int test_dataflow(int a, int b, int c) {
+;   int k = 2 + 3;             // constant: k = 5
+;   int p, q;
+;   if (c) {
+;     int x = b - a;           // (b - a) is very busy at the exit of entry
+;     p = k * 2;               // constant: p = 10
+;     q = x;
+;   } else {
+;     int y = b - a;
+;     p = k + 5;               // constant: p = 10
+;     q = y;
+;   }
+;   int z = 7;                 // constant: z = 7 (the loop does not change it)
+;   for (int i = 0; i + 1 < p; i++)  // not constant: i
+;     ;
+;   int s = b - a;
+;   return z;
+; }
+;
+; Dominators: entry dominates all the blocks, j dominates loop and exit.
+
+define dso_local i32 @test_dataflow(i32 noundef %a, i32 noundef %b, i1 noundef %c) #0 {
+entry:
+  %k = add i32 2, 3
+  br i1 %c, label %l, label %r
+
+l:
+  %x = sub i32 %b, %a
+  %m = mul i32 %k, 2
+  br label %j
+
+r:
+  %y = sub i32 %b, %a
+  %n = add i32 %k, 5
+  br label %j
+
+j:
+  %p = phi i32 [ %m, %l ], [ %n, %r ]
+  %q = phi i32 [ %x, %l ], [ %y, %r ]
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %j ], [ %i2, %loop ]
+  %z = phi i32 [ 7, %j ], [ %z, %loop ]
+  %i2 = add i32 %i, 1
+  %d = icmp slt i32 %i2, %p
+  br i1 %d, label %loop, label %exit
+
+exit:
+  %s = sub i32 %b, %a
+  ret i32 %z
+}
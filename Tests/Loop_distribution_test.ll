@@ -0,0 +1,134 @@
+; void prefix(int n, int *restrict a, int *restrict b, int *restrict c) {
+;   for (int i = 0; i < n; i++) {
+;     a[i + 1] = a[i] + b[i];   // carried dependence: a[i + 1] is read by the next iteration
+;     c[i] = b[i] * 2;          // no carried dependence
+;   }
+;   // the loop is distributed in two loops, the second one computing c can be vectorized:
+;   // for (int i = 0; i < n; i++) a[i + 1] = a[i] + b[i];
+;   // for (int i = 0; i < n; i++) c[i] = b[i] * 2;
+; }
+;
+; int calls;
+; void counted_prefix(int n, int *restrict a, int *restrict b, int *restrict c) {
+;   calls++;                      // in the preheader of the loop: it is split before the loop is copied,
+;   for (int i = 0; i < n; i++) { // so that the increment is still executed once
+;     a[i + 1] = a[i] + b[i];
+;     c[i] = b[i] * 2;
+;   }
+; }
+;
+; int prefix_result(int n, int *restrict a, int *restrict b, int *restrict c) {
+;   for (int i = 0; i < n; i++) {
+;     a[i + 1] = a[i] + b[i];
+;     c[i] = b[i] * 2;
+;   }
+;   return n;                     // a phi of the exit block, coming from the header of the last loop after the
+; }                               // distribution
+
+@calls = dso_local global i32 0, align 4
+
+define dso_local void @prefix(i32 noundef %n, ptr noalias noundef %a, ptr noalias noundef %b, ptr noalias noundef %c) {
+entry:
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %inc, %latch ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %exit
+
+body:
+  %idx = sext i32 %i to i64
+  %src_a = getelementptr inbounds i32, ptr %a, i64 %idx
+  %va = load i32, ptr %src_a, align 4
+  %src_b = getelementptr inbounds i32, ptr %b, i64 %idx
+  %vb = load i32, ptr %src_b, align 4
+  %sum = add nsw i32 %va, %vb
+  %next = add nsw i32 %i, 1
+  %next_idx = sext i32 %next to i64
+  %dst_a = getelementptr inbounds i32, ptr %a, i64 %next_idx
+  store i32 %sum, ptr %dst_a, align 4
+  %vb2 = load i32, ptr %src_b, align 4
+  %mul = mul nsw i32 %vb2, 2
+  %dst_c = getelementptr inbounds i32, ptr %c, i64 %idx
+  store i32 %mul, ptr %dst_c, align 4
+  br label %latch
+
+latch:
+  %inc = add nsw i32 %i, 1
+  br label %header
+
+exit:
+  ret void
+}
+
+define dso_local void @counted_prefix(i32 noundef %n, ptr noalias noundef %a, ptr noalias noundef %b, ptr noalias noundef %c) {
+entry:
+  %calls = load i32, ptr @calls, align 4
+  %calls_inc = add nsw i32 %calls, 1
+  store i32 %calls_inc, ptr @calls, align 4
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %inc, %latch ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %exit
+
+body:
+  %idx = sext i32 %i to i64
+  %src_a = getelementptr inbounds i32, ptr %a, i64 %idx
+  %va = load i32, ptr %src_a, align 4
+  %src_b = getelementptr inbounds i32, ptr %b, i64 %idx
+  %vb = load i32, ptr %src_b, align 4
+  %sum = add nsw i32 %va, %vb
+  %next = add nsw i32 %i, 1
+  %next_idx = sext i32 %next to i64
+  %dst_a = getelementptr inbounds i32, ptr %a, i64 %next_idx
+  store i32 %sum, ptr %dst_a, align 4
+  %vb2 = load i32, ptr %src_b, align 4
+  %mul = mul nsw i32 %vb2, 2
+  %dst_c = getelementptr inbounds i32, ptr %c, i64 %idx
+  store i32 %mul, ptr %dst_c, align 4
+  br label %latch
+
+latch:
+  %inc = add nsw i32 %i, 1
+  br label %header
+
+exit:
+  ret void
+}
+
+define dso_local i32 @prefix_result(i32 noundef %n, ptr noalias noundef %a, ptr noalias noundef %b, ptr noalias noundef %c) {
+entry:
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %inc, %latch ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %exit
+
+body:
+  %idx = sext i32 %i to i64
+  %src_a = getelementptr inbounds i32, ptr %a, i64 %idx
+  %va = load i32, ptr %src_a, align 4
+  %src_b = getelementptr inbounds i32, ptr %b, i64 %idx
+  %vb = load i32, ptr %src_b, align 4
+  %sum = add nsw i32 %va, %vb
+  %next = add nsw i32 %i, 1
+  %next_idx = sext i32 %next to i64
+  %dst_a = getelementptr inbounds i32, ptr %a, i64 %next_idx
+  store i32 %sum, ptr %dst_a, align 4
+  %vb2 = load i32, ptr %src_b, align 4
+  %mul = mul nsw i32 %vb2, 2
+  %dst_c = getelementptr inbounds i32, ptr %c, i64 %idx
+  store i32 %mul, ptr %dst_c, align 4
+  br label %latch
+
+latch:
+  %inc = add nsw i32 %i, 1
+  br label %header
+
+exit:
+  %result = phi i32 [ %n, %header ]
+  ret i32 %result
+}
@@ -0,0 +1,187 @@
+; void map_chain(int n, int *restrict a, int *restrict b) {
+;   for (int i = 0; i < n; i++) b[i] = a[i] + 1;
+;   for (int i = 0; i < n; i++) a[i] = b[i] * 3;
+;   for (int i = 0; i < n; i++) b[i] = a[i] - 2;
+;   for (int i = 0; i < n; i++) a[i] = b[i] << 1;
+;   for (int i = 0; i < n; i++) b[i] = a[i] + 5;
+;   for (int i = 0; i < n; i++) a[i] = b[i] ^ 7;
+;   for (int i = 0; i < n; i++) b[i] = a[i] * 5;
+;   for (int i = 0; i < n; i++) a[i] = b[i] >> 1;
+;   // the 8 adjacent loops are fused into the first one by a single run of the pass
+; }
+
+define dso_local void @map_chain(i32 noundef %n, ptr noalias noundef %a, ptr noalias noundef %b) {
+entry:
+  br label %header0
+
+header0:
+  %i0 = phi i32 [ 0, %entry ], [ %inc0, %latch0 ]
+  %cmp0 = icmp slt i32 %i0, %n
+  br i1 %cmp0, label %body0, label %exit0
+
+body0:
+  %idx0 = sext i32 %i0 to i64
+  %src0 = getelementptr inbounds i32, ptr %a, i64 %idx0
+  %v0 = load i32, ptr %src0, align 4
+  %r0 = add nsw i32 %v0, 1
+  %dst0 = getelementptr inbounds i32, ptr %b, i64 %idx0
+  store i32 %r0, ptr %dst0, align 4
+  br label %latch0
+
+latch0:
+  %inc0 = add nsw i32 %i0, 1
+  br label %header0
+
+exit0:
+  br label %header1
+
+header1:
+  %i1 = phi i32 [ 0, %exit0 ], [ %inc1, %latch1 ]
+  %cmp1 = icmp slt i32 %i1, %n
+  br i1 %cmp1, label %body1, label %exit1
+
+body1:
+  %idx1 = sext i32 %i1 to i64
+  %src1 = getelementptr inbounds i32, ptr %b, i64 %idx1
+  %v1 = load i32, ptr %src1, align 4
+  %r1 = mul nsw i32 %v1, 3
+  %dst1 = getelementptr inbounds i32, ptr %a, i64 %idx1
+  store i32 %r1, ptr %dst1, align 4
+  br label %latch1
+
+latch1:
+  %inc1 = add nsw i32 %i1, 1
+  br label %header1
+
+exit1:
+  br label %header2
+
+header2:
+  %i2 = phi i32 [ 0, %exit1 ], [ %inc2, %latch2 ]
+  %cmp2 = icmp slt i32 %i2, %n
+  br i1 %cmp2, label %body2, label %exit2
+
+body2:
+  %idx2 = sext i32 %i2 to i64
+  %src2 = getelementptr inbounds i32, ptr %a, i64 %idx2
+  %v2 = load i32, ptr %src2, align 4
+  %r2 = sub nsw i32 %v2, 2
+  %dst2 = getelementptr inbounds i32, ptr %b, i64 %idx2
+  store i32 %r2, ptr %dst2, align 4
+  br label %latch2
+
+latch2:
+  %inc2 = add nsw i32 %i2, 1
+  br label %header2
+
+exit2:
+  br label %header3
+
+header3:
+  %i3 = phi i32 [ 0, %exit2 ], [ %inc3, %latch3 ]
+  %cmp3 = icmp slt i32 %i3, %n
+  br i1 %cmp3, label %body3, label %exit3
+
+body3:
+  %idx3 = sext i32 %i3 to i64
+  %src3 = getelementptr inbounds i32, ptr %b, i64 %idx3
+  %v3 = load i32, ptr %src3, align 4
+  %r3 = shl i32 %v3, 1
+  %dst3 = getelementptr inbounds i32, ptr %a, i64 %idx3
+  store i32 %r3, ptr %dst3, align 4
+  br label %latch3
+
+latch3:
+  %inc3 = add nsw i32 %i3, 1
+  br label %header3
+
+exit3:
+  br label %header4
+
+header4:
+  %i4 = phi i32 [ 0, %exit3 ], [ %inc4, %latch4 ]
+  %cmp4 = icmp slt i32 %i4, %n
+  br i1 %cmp4, label %body4, label %exit4
+
+body4:
+  %idx4 = sext i32 %i4 to i64
+  %src4 = getelementptr inbounds i32, ptr %a, i64 %idx4
+  %v4 = load i32, ptr %src4, align 4
+  %r4 = add nsw i32 %v4, 5
+  %dst4 = getelementptr inbounds i32, ptr %b, i64 %idx4
+  store i32 %r4, ptr %dst4, align 4
+  br label %latch4
+
+latch4:
+  %inc4 = add nsw i32 %i4, 1
+  br label %header4
+
+exit4:
+  br label %header5
+
+header5:
+  %i5 = phi i32 [ 0, %exit4 ], [ %inc5, %latch5 ]
+  %cmp5 = icmp slt i32 %i5, %n
+  br i1 %cmp5, label %body5, label %exit5
+
+body5:
+  %idx5 = sext i32 %i5 to i64
+  %src5 = getelementptr inbounds i32, ptr %b, i64 %idx5
+  %v5 = load i32, ptr %src5, align 4
+  %r5 = xor i32 %v5, 7
+  %dst5 = getelementptr inbounds i32, ptr %a, i64 %idx5
+  store i32 %r5, ptr %dst5, align 4
+  br label %latch5
+
+latch5:
+  %inc5 = add nsw i32 %i5, 1
+  br label %header5
+
+exit5:
+  br label %header6
+
+header6:
+  %i6 = phi i32 [ 0, %exit5 ], [ %inc6, %latch6 ]
+  %cmp6 = icmp slt i32 %i6, %n
+  br i1 %cmp6, label %body6, label %exit6
+
+body6:
+  %idx6 = sext i32 %i6 to i64
+  %src6 = getelementptr inbounds i32, ptr %a, i64 %idx6
+  %v6 = load i32, ptr %src6, align 4
+  %r6 = mul nsw i32 %v6, 5
+  %dst6 = getelementptr inbounds i32, ptr %b, i64 %idx6
+  store i32 %r6, ptr %dst6, align 4
+  br label %latch6
+
+latch6:
+  %inc6 = add nsw i32 %i6, 1
+  br label %header6
+
+exit6:
+  br label %header7
+
+header7:
+  %i7 = phi i32 [ 0, %exit6 ], [ %inc7, %latch7 ]
+  %cmp7 = icmp slt i32 %i7, %n
+  br i1 %cmp7, label %body7, label %exit7
+
+body7:
+  %idx7 = sext i32 %i7 to i64
+  %src7 = getelementptr inbounds i32, ptr %b, i64 %idx7
+  %v7 = load i32, ptr %src7, align 4
+  %r7 = ashr i32 %v7, 1
+  %dst7 = getelementptr inbounds i32, ptr %a, i64 %idx7
+  store i32 %r7, ptr %dst7, align 4
+  br label %latch7
+
+latch7:
+  %inc7 = add nsw i32 %i7, 1
+  br label %header7
+
+exit7:
+  br label %return
+
+return:
+  ret void
+}
@@ -0,0 +1,60 @@
+; void scale_offset(int n, int *restrict a, int *restrict b, int *restrict s) {
+;   for (int i = 0; i < n; i++) a[i] = a[i] * 2;
+;   int k = n + 3;        // hoisted before the first loop
+;   s[0] = a[0];          // reads a value written by the first loop, sunk after the second loop
+;   int c = s[1];         // hoisted before the first loop
+;   for (int i = 0; i < n; i++) b[i] = a[i] + k + c;
+;   // the loops are fused once the statements between them have been moved
+; }
+
+define dso_local void @scale_offset(i32 noundef %n, ptr noalias noundef %a, ptr noalias noundef %b, ptr noalias noundef %s) {
+entry:
+  br label %header0
+
+header0:
+  %i0 = phi i32 [ 0, %entry ], [ %inc0, %latch0 ]
+  %cmp0 = icmp slt i32 %i0, %n
+  br i1 %cmp0, label %body0, label %exit0
+
+body0:
+  %idx0 = sext i32 %i0 to i64
+  %src0 = getelementptr inbounds i32, ptr %a, i64 %idx0
+  %v0 = load i32, ptr %src0, align 4
+  %r0 = mul nsw i32 %v0, 2
+  store i32 %r0, ptr %src0, align 4
+  br label %latch0
+
+latch0:
+  %inc0 = add nsw i32 %i0, 1
+  br label %header0
+
+exit0:
+  %k = add nsw i32 %n, 3
+  %a0 = load i32, ptr %a, align 4
+  store i32 %a0, ptr %s, align 4
+  %s1 = getelementptr inbounds i32, ptr %s, i64 1
+  %c = load i32, ptr %s1, align 4
+  br label %header1
+
+header1:
+  %i1 = phi i32 [ 0, %exit0 ], [ %inc1, %latch1 ]
+  %cmp1 = icmp slt i32 %i1, %n
+  br i1 %cmp1, label %body1, label %exit1
+
+body1:
+  %idx1 = sext i32 %i1 to i64
+  %src1 = getelementptr inbounds i32, ptr %a, i64 %idx1
+  %v1 = load i32, ptr %src1, align 4
+  %add1 = add nsw i32 %v1, %k
+  %r1 = add nsw i32 %add1, %c
+  %dst1 = getelementptr inbounds i32, ptr %b, i64 %idx1
+  store i32 %r1, ptr %dst1, align 4
+  br label %latch1
+
+latch1:
+  %inc1 = add nsw i32 %i1, 1
+  br label %header1
+
+exit1:
+  ret void
+}
@@ -0,0 +1,140 @@
+; #define H 16
+; #define W 4096
+; int img[H][W], tmp[H + 1][W], out[H][W];
+; void pipeline() {
+;   for (int y = 0; y < H; y++) for (int x = 0; x < W; x++) tmp[y][x] = img[y][x] << 1;
+;   for (int y = 0; y < H; y++) for (int x = 0; x < W; x++) out[y][x] = tmp[y][x] + img[y][x];
+;   // the outer loops are fused since the second nest reads the row written in the same iteration, then the inner
+;   // loops become adjacent in the fused loop and are fused in turn
+;   for (int y = 0; y < H; y++) for (int x = 0; x < W; x++) img[y][x] = tmp[y + 1][x];
+;   // the third nest reads the row written by the next iteration of the fused loop, hence it is not fused
+; }
+; opt -passes=loopfusion reports:
+; Fusion of header0 and header1: 0.31 -> 0.19 cache lines per iteration, 1 live values (8 registers), profitable
+; Fusion of inner0 and inner1: 0.31 -> 0.19 cache lines per iteration, 3 live values (8 registers), profitable
+; pipeline: 2 fusions
+
+@img = dso_local global [16 x [4096 x i32]] zeroinitializer, align 16
+@tmp = dso_local global [17 x [4096 x i32]] zeroinitializer, align 16
+@out = dso_local global [16 x [4096 x i32]] zeroinitializer, align 16
+
+define dso_local void @pipeline() {
+entry:
+  br label %header0
+
+header0:
+  %i0 = phi i32 [ 0, %entry ], [ %inc0, %latch0 ]
+  %cmp0 = icmp slt i32 %i0, 16
+  br i1 %cmp0, label %body0, label %exit0
+
+body0:
+  %y0 = zext i32 %i0 to i64
+  br label %inner0
+
+inner0:
+  %j0 = phi i32 [ 0, %body0 ], [ %jnc0, %innerlatch0 ]
+  %jcmp0 = icmp slt i32 %j0, 4096
+  br i1 %jcmp0, label %innerbody0, label %innerexit0
+
+innerbody0:
+  %x0 = zext i32 %j0 to i64
+  %a0 = getelementptr inbounds [16 x [4096 x i32]], ptr @img, i64 0, i64 %y0, i64 %x0
+  %v0 = load i32, ptr %a0, align 4
+  %r0 = shl nsw i32 %v0, 1
+  %d0 = getelementptr inbounds [17 x [4096 x i32]], ptr @tmp, i64 0, i64 %y0, i64 %x0
+  store i32 %r0, ptr %d0, align 4
+  br label %innerlatch0
+
+innerlatch0:
+  %jnc0 = add nsw i32 %j0, 1
+  br label %inner0
+
+innerexit0:
+  br label %latch0
+
+latch0:
+  %inc0 = add nsw i32 %i0, 1
+  br label %header0
+
+exit0:
+  br label %header1
+
+header1:
+  %i1 = phi i32 [ 0, %exit0 ], [ %inc1, %latch1 ]
+  %cmp1 = icmp slt i32 %i1, 16
+  br i1 %cmp1, label %body1, label %exit1
+
+body1:
+  %y1 = zext i32 %i1 to i64
+  br label %inner1
+
+inner1:
+  %j1 = phi i32 [ 0, %body1 ], [ %jnc1, %innerlatch1 ]
+  %jcmp1 = icmp slt i32 %j1, 4096
+  br i1 %jcmp1, label %innerbody1, label %innerexit1
+
+innerbody1:
+  %x1 = zext i32 %j1 to i64
+  %a1 = getelementptr inbounds [17 x [4096 x i32]], ptr @tmp, i64 0, i64 %y1, i64 %x1
+  %v1 = load i32, ptr %a1, align 4
+  %b1 = getelementptr inbounds [16 x [4096 x i32]], ptr @img, i64 0, i64 %y1, i64 %x1
+  %w1 = load i32, ptr %b1, align 4
+  %r1 = add nsw i32 %v1, %w1
+  %d1 = getelementptr inbounds [16 x [4096 x i32]], ptr @out, i64 0, i64 %y1, i64 %x1
+  store i32 %r1, ptr %d1, align 4
+  br label %innerlatch1
+
+innerlatch1:
+  %jnc1 = add nsw i32 %j1, 1
+  br label %inner1
+
+innerexit1:
+  br label %latch1
+
+latch1:
+  %inc1 = add nsw i32 %i1, 1
+  br label %header1
+
+exit1:
+  br label %header2
+
+header2:
+  %i2 = phi i32 [ 0, %exit1 ], [ %inc2, %latch2 ]
+  %cmp2 = icmp slt i32 %i2, 16
+  br i1 %cmp2, label %body2, label %exit2
+
+body2:
+  %y2 = zext i32 %i2 to i64
+  br label %inner2
+
+inner2:
+  %j2 = phi i32 [ 0, %body2 ], [ %jnc2, %innerlatch2 ]
+  %jcmp2 = icmp slt i32 %j2, 4096
+  br i1 %jcmp2, label %innerbody2, label %innerexit2
+
+innerbody2:
+  %x2 = zext i32 %j2 to i64
+  %n2 = add nuw nsw i64 %y2, 1
+  %a2 = getelementptr inbounds [17 x [4096 x i32]], ptr @tmp, i64 0, i64 %n2, i64 %x2
+  %v2 = load i32, ptr %a2, align 4
+  %d2 = getelementptr inbounds [16 x [4096 x i32]], ptr @img, i64 0, i64 %y2, i64 %x2
+  store i32 %v2, ptr %d2, align 4
+  br label %innerlatch2
+
+innerlatch2:
+  %jnc2 = add nsw i32 %j2, 1
+  br label %inner2
+
+innerexit2:
+  br label %latch2
+
+latch2:
+  %inc2 = add nsw i32 %i2, 1
+  br label %header2
+
+exit2:
+  br label %end
+
+end:
+  ret void
+}
@@ -0,0 +1,55 @@
+; void map_peel(int n, int *restrict a, int *restrict b) {
+;   for (int i = 0; i < n; i++) a[i] = a[i] + 1;
+;   for (int i = 0; i < n - 1; i++) b[i] = a[i] * 3;
+;   // the last iteration of the first loop is peeled into a copy placed after the second loop,
+;   // then both the loops run up to n - 1 and are fused:
+;   // for (int i = 0; i < n - 1; i++) { a[i] = a[i] + 1; b[i] = a[i] * 3; }
+;   // for (int i = max(n - 1, 0); i < n; i++) a[i] = a[i] + 1;
+; }
+
+define dso_local void @map_peel(i32 noundef %n, ptr noalias noundef %a, ptr noalias noundef %b) {
+entry:
+  %sub = sub nsw i32 %n, 1
+  br label %header0
+
+header0:
+  %i0 = phi i32 [ 0, %entry ], [ %inc0, %latch0 ]
+  %cmp0 = icmp slt i32 %i0, %n
+  br i1 %cmp0, label %body0, label %exit0
+
+body0:
+  %idx0 = sext i32 %i0 to i64
+  %src0 = getelementptr inbounds i32, ptr %a, i64 %idx0
+  %v0 = load i32, ptr %src0, align 4
+  %r0 = add nsw i32 %v0, 1
+  store i32 %r0, ptr %src0, align 4
+  br label %latch0
+
+latch0:
+  %inc0 = add nsw i32 %i0, 1
+  br label %header0
+
+exit0:
+  br label %header1
+
+header1:
+  %i1 = phi i32 [ 0, %exit0 ], [ %inc1, %latch1 ]
+  %cmp1 = icmp slt i32 %i1, %sub
+  br i1 %cmp1, label %body1, label %exit1
+
+body1:
+  %idx1 = sext i32 %i1 to i64
+  %src1 = getelementptr inbounds i32, ptr %a, i64 %idx1
+  %v1 = load i32, ptr %src1, align 4
+  %r1 = mul nsw i32 %v1, 3
+  %dst1 = getelementptr inbounds i32, ptr %b, i64 %idx1
+  store i32 %r1, ptr %dst1, align 4
+  br label %latch1
+
+latch1:
+  %inc1 = add nsw i32 %i1, 1
+  br label %header1
+
+exit1:
+  ret void
+}
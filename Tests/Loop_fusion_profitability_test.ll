@@ -0,0 +1,80 @@
+; void streams(int n, int *restrict a, int *restrict b, int *restrict c, int *restrict d) {
+;   for (int i = 0; i < n; i++) b[i] = a[i] + 1;
+;   for (int i = 0; i < n; i++) d[i] = c[i] * 3;
+;   // the loops share no memory stream: the fusion would not save any cache miss, hence it is not profitable
+;   for (int i = 0; i < n; i++) a[i] = d[i] - b[i];
+;   // the third loop reads the stream d written by the second loop, their fusion is profitable
+; }
+; opt -passes=loopfusion reports:
+; Fusion of header0 and header1: 0.25 -> 0.25 cache lines per iteration, 6 live values (8 registers), not profitable
+; Fusion of header1 and header2: 0.31 -> 0.25 cache lines per iteration, 6 live values (8 registers), profitable
+
+define dso_local void @streams(i32 noundef %n, ptr noalias noundef %a, ptr noalias noundef %b, ptr noalias noundef %c, ptr noalias noundef %d) {
+entry:
+  br label %header0
+
+header0:
+  %i0 = phi i32 [ 0, %entry ], [ %inc0, %latch0 ]
+  %cmp0 = icmp slt i32 %i0, %n
+  br i1 %cmp0, label %body0, label %exit0
+
+body0:
+  %idx0 = sext i32 %i0 to i64
+  %src0 = getelementptr inbounds i32, ptr %a, i64 %idx0
+  %v0 = load i32, ptr %src0, align 4
+  %r0 = add nsw i32 %v0, 1
+  %dst0 = getelementptr inbounds i32, ptr %b, i64 %idx0
+  store i32 %r0, ptr %dst0, align 4
+  br label %latch0
+
+latch0:
+  %inc0 = add nsw i32 %i0, 1
+  br label %header0
+
+exit0:
+  br label %header1
+
+header1:
+  %i1 = phi i32 [ 0, %exit0 ], [ %inc1, %latch1 ]
+  %cmp1 = icmp slt i32 %i1, %n
+  br i1 %cmp1, label %body1, label %exit1
+
+body1:
+  %idx1 = sext i32 %i1 to i64
+  %src1 = getelementptr inbounds i32, ptr %c, i64 %idx1
+  %v1 = load i32, ptr %src1, align 4
+  %r1 = mul nsw i32 %v1, 3
+  %dst1 = getelementptr inbounds i32, ptr %d, i64 %idx1
+  store i32 %r1, ptr %dst1, align 4
+  br label %latch1
+
+latch1:
+  %inc1 = add nsw i32 %i1, 1
+  br label %header1
+
+exit1:
+  br label %header2
+
+header2:
+  %i2 = phi i32 [ 0, %exit1 ], [ %inc2, %latch2 ]
+  %cmp2 = icmp slt i32 %i2, %n
+  br i1 %cmp2, label %body2, label %exit2
+
+body2:
+  %idx2 = sext i32 %i2 to i64
+  %src2 = getelementptr inbounds i32, ptr %d, i64 %idx2
+  %v2 = load i32, ptr %src2, align 4
+  %src3 = getelementptr inbounds i32, ptr %b, i64 %idx2
+  %v3 = load i32, ptr %src3, align 4
+  %r2 = sub nsw i32 %v2, %v3
+  %dst2 = getelementptr inbounds i32, ptr %a, i64 %idx2
+  store i32 %r2, ptr %dst2, align 4
+  br label %latch2
+
+latch2:
+  %inc2 = add nsw i32 %i2, 1
+  br label %header2
+
+exit2:
+  ret void
+}
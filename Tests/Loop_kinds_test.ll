@@ -0,0 +1,44 @@
+; void kinds(int *out, int *p, int a, int b, int n) {
+;   for (int i = 0; i < n; i++) {
+;     int *q = p + a;                // getelementptr and sext -> moved in the preheader
+;     int m = a > b ? a : b;         // icmp and select -> moved in the preheader
+;     int s = smax(a, b);            // readnone intrinsic -> moved in the preheader
+;     int d = a / 7;                 // cannot trap -> moved in the preheader
+;     int e = a / b;                 // may trap, and it is not executed if n <= 0 -> not moved
+;     out[i] = m + s + d + e + (int)(long)q;
+;   }
+; }
+
+declare i32 @llvm.smax.i32(i32, i32)
+
+define dso_local void @kinds(ptr noundef %out, ptr noundef %p, i32 noundef %a, i32 noundef %b, i32 noundef %n) {
+entry:
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %body ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %exit
+
+body:
+  %idx.ext = sext i32 %a to i64
+  %q = getelementptr inbounds i32, ptr %p, i64 %idx.ext
+  %cmp1 = icmp sgt i32 %a, %b
+  %m = select i1 %cmp1, i32 %a, i32 %b
+  %s = call i32 @llvm.smax.i32(i32 %a, i32 %b)
+  %d = sdiv i32 %a, 7
+  %e = sdiv i32 %a, %b
+  %add = add nsw i32 %m, %s
+  %add2 = add nsw i32 %add, %d
+  %add3 = add nsw i32 %add2, %e
+  %qi = ptrtoint ptr %q to i32
+  %add4 = add nsw i32 %add3, %qi
+  %idxprom = sext i32 %i to i64
+  %arrayidx = getelementptr inbounds i32, ptr %out, i64 %idxprom
+  store i32 %add4, ptr %arrayidx, align 4
+  %i.next = add nsw i32 %i, 1
+  br label %header
+
+exit:
+  ret void
+}
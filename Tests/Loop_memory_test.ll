@@ -0,0 +1,75 @@
+; Run with loop-rotate before loopopts (e.g. -passes='loop-mssa(loop-rotate,loopopts)'), so that the body of the
+; loops is executed in every iteration.
+;
+; void acc(int *restrict a, int *restrict x, int *restrict scale, int n) {
+;   for (int k = 0; k < 8; k++)
+;     for (int i = 0; i < n; i++)
+;       a[k] += x[i] * *scale;    // *scale is not written in the loops -> loaded once before the i loop (not out of
+;                                 // the k loop: it is not loaded at all if n <= 0, and it may not be dereferenceable)
+;                                 // a[k] -> loaded before the i loop, kept in a phi, stored after the i loop
+; }
+;
+; void no_restrict(int *a, int *b, int n) {
+;   for (int i = 0; i < n; i++)
+;     *a += *b;                   // a and b may alias: nothing is moved
+; }
+
+define dso_local void @acc(ptr noalias noundef %a, ptr noalias noundef %x, ptr noalias noundef %scale, i32 noundef %n) {
+entry:
+  br label %k.header
+
+k.header:
+  %k = phi i32 [ 0, %entry ], [ %k.next, %k.latch ]
+  %k.cmp = icmp slt i32 %k, 8
+  br i1 %k.cmp, label %k.body, label %exit
+
+k.body:
+  %idxprom = sext i32 %k to i64
+  %arrayidx = getelementptr inbounds i32, ptr %a, i64 %idxprom
+  br label %i.header
+
+i.header:
+  %i = phi i32 [ 0, %k.body ], [ %i.next, %i.body ]
+  %i.cmp = icmp slt i32 %i, %n
+  br i1 %i.cmp, label %i.body, label %k.latch
+
+i.body:
+  %idxprom1 = sext i32 %i to i64
+  %arrayidx2 = getelementptr inbounds i32, ptr %x, i64 %idxprom1
+  %0 = load i32, ptr %arrayidx2, align 4
+  %1 = load i32, ptr %scale, align 4
+  %mul = mul nsw i32 %0, %1
+  %2 = load i32, ptr %arrayidx, align 4
+  %add = add nsw i32 %2, %mul
+  store i32 %add, ptr %arrayidx, align 4
+  %i.next = add nsw i32 %i, 1
+  br label %i.header
+
+k.latch:
+  %k.next = add nsw i32 %k, 1
+  br label %k.header
+
+exit:
+  ret void
+}
+
+define dso_local void @no_restrict(ptr noundef %a, ptr noundef %b, i32 noundef %n) {
+entry:
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %body ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %exit
+
+body:
+  %0 = load i32, ptr %b, align 4
+  %1 = load i32, ptr %a, align 4
+  %add = add nsw i32 %1, %0
+  store i32 %add, ptr %a, align 4
+  %i.next = add nsw i32 %i, 1
+  br label %header
+
+exit:
+  ret void
+}
@@ -0,0 +1,54 @@
+; void stencil(int *out, int n, int s) {
+;   for (int i = 0; i < n; i++)
+;     for (int j = 0; j < n; j++)
+;       for (int k = 0; k < n; k++) {
+;         int scale = s * 4;           // invariant in the whole nest -> moved in the preheader of the i loop
+;         int row = i * n;             // invariant in the j and k loops -> moved in the preheader of the j loop
+;         int plane = (row + j) * n;   // invariant in the k loop -> moved in the preheader of the k loop
+;         out[plane + k] = k * scale;
+;       }
+; }
+
+define dso_local void @stencil(ptr noundef %out, i32 noundef %n, i32 noundef %s) {
+entry:
+  br label %i.header
+
+i.header:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %i.latch ]
+  %i.cmp = icmp slt i32 %i, %n
+  br i1 %i.cmp, label %j.header, label %exit
+
+j.header:
+  %j = phi i32 [ %j.next, %j.latch ], [ 0, %i.header ]
+  %j.cmp = icmp slt i32 %j, %n
+  br i1 %j.cmp, label %k.header, label %i.latch
+
+k.header:
+  %k = phi i32 [ %k.next, %k.body ], [ 0, %j.header ]
+  %k.cmp = icmp slt i32 %k, %n
+  br i1 %k.cmp, label %k.body, label %j.latch
+
+k.body:
+  %scale = mul nsw i32 %s, 4
+  %row = mul nsw i32 %i, %n
+  %add = add nsw i32 %row, %j
+  %plane = mul nsw i32 %add, %n
+  %val = mul nsw i32 %k, %scale
+  %idx = add nsw i32 %plane, %k
+  %idxprom = sext i32 %idx to i64
+  %arrayidx = getelementptr inbounds i32, ptr %out, i64 %idxprom
+  store i32 %val, ptr %arrayidx, align 4
+  %k.next = add nsw i32 %k, 1
+  br label %k.header
+
+j.latch:
+  %j.next = add nsw i32 %j, 1
+  br label %j.header
+
+i.latch:
+  %i.next = add nsw i32 %i, 1
+  br label %i.header
+
+exit:
+  ret void
+}
@@ -0,0 +1,45 @@
+; int sinking(int n, int a) {
+;   int s = 0, last;
+;   int i = 0;
+;   do {
+;     last = i * a + 5;              // only used after the loop -> sunk to the exit, computed once
+;     int cold = (i * 3) ^ a;        // only used when i % 8 == 7 -> sunk to the cold side of the branch
+;     int v = 0;
+;     if ((i & 7) == 7)
+;       v = cold + 1;
+;     s += v;
+;     i++;
+;   } while (i < n);
+;   return s + last;
+; }
+
+define dso_local i32 @sinking(i32 noundef %n, i32 noundef %a) {
+entry:
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %latch ]
+  %mul = mul nsw i32 %i, %a
+  %last = add nsw i32 %mul, 5
+  %mul1 = mul nsw i32 %i, 3
+  %cold = xor i32 %mul1, %a
+  %and = and i32 %i, 7
+  %cmp = icmp eq i32 %and, 7
+  br i1 %cmp, label %rare, label %latch
+
+rare:
+  %add = add nsw i32 %cold, 1
+  br label %latch
+
+latch:
+  %v = phi i32 [ %add, %rare ], [ 0, %header ]
+  %s.next = add nsw i32 %s, %v
+  %i.next = add nsw i32 %i, 1
+  %cmp2 = icmp slt i32 %i.next, %n
+  br i1 %cmp2, label %header, label %exit
+
+exit:
+  %res = add nsw i32 %s.next, %last
+  ret i32 %res
+}
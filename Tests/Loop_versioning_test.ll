@@ -0,0 +1,29 @@
+; void scale(int *a, int *k, int n) {
+;   for (int i = 0; i < n; i++)
+;     a[i] = a[i] * *k;              // a may point to *k: the load of *k stays in the loop
+; }
+;
+; The loop is versioned on the runtime check !(a < k + 1 && k < a + n): in the copy executed when the ranges do
+; not overlap, the accesses to a are annotated as not aliasing *k, and the load of *k is moved in the preheader.
+; The copy executed otherwise (header.lver.orig) is left as is.
+
+define dso_local void @scale(ptr noundef %a, ptr noundef %k, i32 noundef %n) {
+entry:
+  %cmp1 = icmp sgt i32 %n, 0
+  br i1 %cmp1, label %header, label %exit
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %header ]
+  %kv = load i32, ptr %k, align 4
+  %idxprom = sext i32 %i to i64
+  %arrayidx = getelementptr inbounds i32, ptr %a, i64 %idxprom
+  %v = load i32, ptr %arrayidx, align 4
+  %mul = mul nsw i32 %v, %kv
+  store i32 %mul, ptr %arrayidx, align 4
+  %i.next = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %header, label %exit
+
+exit:
+  ret void
+}
@@ -3,7 +3,7 @@
 ;   int c = 0 - b;  // -> c = 0 - a
 ;   int d = e / 1;  // -> d = e; -> deleted
 ;   int f = e - 0;  // -> f = e; -> deleted
-;   int g = b + c;  // -> g = a + c
+;   int g = b + c;  // -> g = a + c; -> g = 0 (a - a is cancelled by reassociation)
 ;   int h = d + f;  // -> h = e + e
 ;   return g * h;
 ; }
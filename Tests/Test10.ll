@@ -0,0 +1,35 @@
+; typedef int v8i __attribute__((vector_size(32)));
+; typedef unsigned v4u __attribute__((vector_size(16)));
+;
+; v8i test_vector(v8i a, v4u u, v4u *p) {
+;   v8i b = a + 0;                          // -> b = a
+;   v8i c = b * 9;                          // -> c = (b << 3) + b
+;   v8i d = (c + 5) - 5;                    // -> d = c
+;   v8i e = (v8i){1, 2, 3, 4, 5, 6, 7, 8} * 3;  // -> e = {3, 6, 9, 12, 15, 18, 21, 24}
+;   v4u f = u * (v4u){1, 2, 4, 8};          // -> f = u << {0, 1, 2, 3}
+;   v4u g = u % (v4u){2, 4, 8, 16};         // -> g = u & {1, 3, 7, 15}
+;   v4u h = u / 10;                         // -> h = mulhu(u, 0xCCCCCCCD) >> 3
+;   v4u i = u * (v4u){3, 5, 7, 9};          // not optimized: different lanes are not powers of two
+;   *p = f + g + h + i;
+;   return d + e;
+; }
+
+target triple = "x86_64-unknown-linux-gnu"
+
+define dso_local <8 x i32> @test_vector(<8 x i32> noundef %0, <4 x i32> noundef %1, ptr noundef %2) #0 {
+  %4 = add <8 x i32> %0, zeroinitializer
+  %5 = mul <8 x i32> %4, <i32 9, i32 9, i32 9, i32 9, i32 9, i32 9, i32 9, i32 9>
+  %6 = add <8 x i32> %5, <i32 5, i32 5, i32 5, i32 5, i32 5, i32 5, i32 5, i32 5>
+  %7 = sub <8 x i32> %6, <i32 5, i32 5, i32 5, i32 5, i32 5, i32 5, i32 5, i32 5>
+  %8 = mul <8 x i32> <i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8>, <i32 3, i32 3, i32 3, i32 3, i32 3, i32 3, i32 3, i32 3>
+  %9 = mul <4 x i32> %1, <i32 1, i32 2, i32 4, i32 8>
+  %10 = urem <4 x i32> %1, <i32 2, i32 4, i32 8, i32 16>
+  %11 = udiv <4 x i32> %1, <i32 10, i32 10, i32 10, i32 10>
+  %12 = mul <4 x i32> %1, <i32 3, i32 5, i32 7, i32 9>
+  %13 = add <4 x i32> %9, %10
+  %14 = add <4 x i32> %13, %11
+  %15 = add <4 x i32> %14, %12
+  store <4 x i32> %15, ptr %2, align 16
+  %16 = add <8 x i32> %7, %8
+  ret <8 x i32> %16
+}
@@ -0,0 +1,46 @@
+; int c, d, e, f, g, h, i;
+;
+; void test_reassociation(int a, int b) {
+;   c = ((a + 3) + 5) - 7;  // -> c = a + 1
+;   d = (b * 4) * 8;        // -> d = b * 32; -> d = b << 5
+;   e = (a << 2) << 3;      // -> e = a * 32; -> e = a << 5
+;   f = (a + b) - a;        // -> f = b
+;   g = (b ^ a) ^ b;        // -> g = a
+;   h = (a & 12) & 10;      // -> h = a & 8
+;   i = (3 - a) + (b + a);  // -> i = b + 3
+; }
+
+@c = dso_local global i32 0, align 4
+@d = dso_local global i32 0, align 4
+@e = dso_local global i32 0, align 4
+@f = dso_local global i32 0, align 4
+@g = dso_local global i32 0, align 4
+@h = dso_local global i32 0, align 4
+@i = dso_local global i32 0, align 4
+
+define dso_local void @test_reassociation(i32 noundef %0, i32 noundef %1) #0 {
+  %3 = add nsw i32 %0, 3
+  %4 = add nsw i32 %3, 5
+  %5 = sub nsw i32 %4, 7
+  %6 = mul nsw i32 %1, 4
+  %7 = mul nsw i32 %6, 8
+  %8 = shl i32 %0, 2
+  %9 = shl i32 %8, 3
+  %10 = add nsw i32 %0, %1
+  %11 = sub nsw i32 %10, %0
+  %12 = xor i32 %1, %0
+  %13 = xor i32 %12, %1
+  %14 = and i32 %0, 12
+  %15 = and i32 %14, 10
+  %16 = sub nsw i32 3, %0
+  %17 = add nsw i32 %1, %0
+  %18 = add nsw i32 %16, %17
+  store i32 %5, ptr @c, align 4
+  store i32 %7, ptr @d, align 4
+  store i32 %9, ptr @e, align 4
+  store i32 %11, ptr @f, align 4
+  store i32 %13, ptr @g, align 4
+  store i32 %15, ptr @h, align 4
+  store i32 %18, ptr @i, align 4
+  ret void
+}
@@ -0,0 +1,22 @@
+; int test_dead_chain(int a) {
+;   int b = a + 1;    // -> dead once c is erased; -> deleted
+;   int c = b * 4;    // -> dead once d is erased; -> deleted
+;   int d = c - 3;    // -> dead once e is erased; -> deleted
+;   int e = d + 5;    // -> dead once f is erased; -> deleted
+;   int f = e * 2;    // -> never used; -> deleted
+;   int g = a + 0;    // -> g = a; -> deleted
+;   return g;
+; }
+;
+; Each erased instruction makes the previous one dead: only its operands are visited again,
+; the block is not rescanned once per erased instruction.
+
+define dso_local i32 @test_dead_chain(i32 noundef %0) #0 {
+  %2 = add nsw i32 %0, 1
+  %3 = mul nsw i32 %2, 4
+  %4 = sub nsw i32 %3, 3
+  %5 = add nsw i32 %4, 5
+  %6 = mul nsw i32 %5, 2
+  %7 = add nsw i32 %0, 0
+  ret i32 %7
+}
@@ -0,0 +1,24 @@
+; int test_first(int a) {
+;   int b = a * 1;    // -> b = a; -> deleted
+;   return b;
+; }
+;
+; int test_second(int a) {
+;   int b = a + 0;    // -> b = a; -> deleted
+;   int c = b * 8;    // -> c = a << 3
+;   return c;
+; }
+;
+; Every function of the module is optimized, also after a previous function has been changed.
+; The functions are independent, hence they can be optimized in parallel with -localopts-threads=<N>.
+
+define dso_local i32 @test_first(i32 noundef %0) #0 {
+  %2 = mul nsw i32 %0, 1
+  ret i32 %2
+}
+
+define dso_local i32 @test_second(i32 noundef %0) #0 {
+  %2 = add nsw i32 %0, 0
+  %3 = mul nsw i32 %2, 8
+  ret i32 %3
+}
@@ -0,0 +1,19 @@
+; long test_mul_decomposition(long a) {
+;   long b = a * 17;                  // -> b = (a << 4) + a
+;   long c = b * -6;                  // -> c = (b << 1) - (b << 3)
+;   long d = c * 1099511627775;       // -> d = (c << 40) - c
+;   long e = d * -1;                  // -> e = 0 - d; -> e = c - (c << 40) (reassociated with d)
+;   long f = e * 11;                  // not optimized: three terms are slower than the multiplication
+;   return f;
+; }
+
+target triple = "x86_64-unknown-linux-gnu"
+
+define dso_local i64 @test_mul_decomposition(i64 noundef %0) #0 {
+  %2 = mul nsw i64 %0, 17
+  %3 = mul nsw i64 %2, -6
+  %4 = mul nsw i64 %3, 1099511627775
+  %5 = mul nsw i64 %4, -1
+  %6 = mul nsw i64 %5, 11
+  ret i64 %6
+}
@@ -0,0 +1,26 @@
+; int test_div_by_const(int a, unsigned u) {
+;   unsigned b = u / 7;   // -> b = (((u - q) >> 1) + q) >> 2, q = mulhu(u, 0x24924925)
+;   unsigned c = u % 8;   // -> c = u & 7
+;   int d = a / 4;        // -> d = (a + ((a >> 1) >>> 30)) >> 2
+;   int e = a / -3;       // -> e = q + (q >>> 31), q = (mulhs(a, 0x55555555) - a) >> 1
+;   int f = a % 10;       // -> f = a - (a / 10) * 10
+;   int g = 12 / 0;       // not optimized: division by zero
+;   return b + c + d + e + f + g;
+; }
+
+target triple = "x86_64-unknown-linux-gnu"
+
+define dso_local i32 @test_div_by_const(i32 noundef %0, i32 noundef %1) #0 {
+  %3 = udiv i32 %1, 7
+  %4 = urem i32 %1, 8
+  %5 = sdiv i32 %0, 4
+  %6 = sdiv i32 %0, -3
+  %7 = srem i32 %0, 10
+  %8 = sdiv i32 12, 0
+  %9 = add i32 %3, %4
+  %10 = add i32 %9, %5
+  %11 = add i32 %10, %6
+  %12 = add i32 %11, %7
+  %13 = add i32 %12, %8
+  ret i32 %13
+}
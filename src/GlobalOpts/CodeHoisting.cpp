@@ -0,0 +1,151 @@
+#include "llvm/Transforms/Utils/CodeHoisting.h"
+#include "llvm/Transforms/Utils/DataFlow.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+
+// #define DEBUG
+
+using namespace llvm;
+
+/** @brief Check if the operands of an expression are available at the end of a block.
+ *
+ * @param I an instruction computing the expression
+ * @param B the block
+ * @param DT dominator tree
+ * @return true if every operand is a constant, an argument or an instruction dominating the end of B
+*/
+bool areOperandsAvailable (Instruction *I, BasicBlock *B, DominatorTree &DT)
+{
+    for (Value *Op : I->operands())
+    {
+        Instruction *OpInst = dyn_cast<Instruction>(Op);
+        if (OpInst && !DT.dominates(OpInst, B->getTerminator()))
+            return false;
+    }
+    return true;
+}
+
+/** @brief Hoist an expression very busy at the exit of a block to the end of the block.
+ * The copies of the expression dominated by the block compute the same value, hence they are replaced by the
+ * hoisted instruction. If the expression is already computed by an instruction dominating the end of the block,
+ * that instruction replaces the copies instead.
+ * The expression is hoisted only if it removes more instructions than it adds, and only if it cannot trap, since
+ * a path which never reaches the copies (e.g. a call which does not return) would execute it anyway.
+ *
+ * @param Copies the instructions computing the expression, updated with the changes
+ * @param B the block
+ * @param DT dominator tree
+ * @param Hoisted incremented if an instruction is added to B
+ * @return the number of copies removed
+*/
+unsigned hoistExpression (SmallVectorImpl<Instruction*> &Copies, BasicBlock *B, DominatorTree &DT, unsigned &Hoisted)
+{
+    Instruction *Available = nullptr;
+    SmallVector<Instruction*, 4> Dominated;
+    for (Instruction *I : Copies)
+    {
+        if (DT.dominates(I, B->getTerminator()))
+            Available = I;
+        else if (DT.dominates(B, I->getParent()))
+            Dominated.push_back(I);
+    }
+
+    if (Dominated.empty() || (!Available && Dominated.size() < 2))
+        return 0;
+
+    Instruction *Template = Dominated.front();
+    if (!Available)
+    {
+        if (!areOperandsAvailable(Template, B, DT) || !isSafeToSpeculativelyExecute(Template))
+            return 0;
+
+        Available = Template->clone();
+        Available->takeName(Template);
+        Available->insertBefore(B->getTerminator());
+        Copies.push_back(Available);
+        Hoisted++;
+    }
+
+    // the instruction replacing the copies, hoisted or not, only keeps the flags (e.g. nsw) shared by all of them,
+    // otherwise a copy without the flag would be replaced by a value which may be poison
+    for (Instruction *I : Dominated)
+        Available->andIRFlags(I);
+
+    for (Instruction *I : Dominated)
+    {
+        #ifdef DEBUG
+            outs() << "[hoistExpression]\tReplacing " << *I << " with " << *Available << "\n";
+        #endif
+
+        I->replaceAllUsesWith(Available);
+        I->eraseFromParent();
+        Copies.erase(find(Copies, I));
+    }
+    return Dominated.size();
+}
+
+/** @brief Hoist the very busy expressions at the exit of the blocks with more than one successor.
+ * The blocks are visited in reverse post order, so that an expression is hoisted to the highest block where it is
+ * very busy; the analysis is not updated after hoisting, since the copies are looked up again through the
+ * dominator tree.
+ *
+ * @param F function
+ * @param DT dominator tree
+ * @param Hoisted incremented for each instruction added
+ * @return the number of copies removed
+*/
+unsigned hoistVeryBusyExpressions (Function &F, DominatorTree &DT, unsigned &Hoisted)
+{
+    VeryBusyExpressions VBE(F);
+    DataFlowSolver<VeryBusyExpressions> Solver(F, VBE);
+    Solver.solve();
+
+    // the instructions computing each expression, filled when the expression is first looked up
+    DenseMap<unsigned, SmallVector<Instruction*, 4>> Copies;
+    unsigned Removed = 0;
+
+    for (BasicBlock *B : Solver.getOrder())
+    {
+        if (B->getTerminator()->getNumSuccessors() < 2)
+            continue;
+
+        for (unsigned E : Solver.getOut(B).set_bits())
+        {
+            auto [It, New] = Copies.try_emplace(E);
+            if (New)
+                It->second.append(VBE.getInstructions(E).begin(), VBE.getInstructions(E).end());
+            Removed += hoistExpression(It->second, B, DT, Hoisted);
+        }
+    }
+    return Removed;
+}
+
+/** @brief Code hoisting driven by the very busy expressions.
+ * Replacing the copies of an expression makes the expressions using them identical (e.g. the additions of a
+ * common base to the same scaled index), hence the analysis is run again until nothing is hoisted.
+ * The number of removed instructions is reported for each function which is changed.
+ *
+ * @param F function
+ * @param AM function analysis manager
+*/
+PreservedAnalyses CodeHoisting::run (Function &F, FunctionAnalysisManager &AM)
+{
+    if (F.isDeclaration())
+        return PreservedAnalyses::all();
+
+    DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
+
+    unsigned Removed = 0, Hoisted = 0;
+    while (unsigned R = hoistVeryBusyExpressions(F, DT, Hoisted))
+        Removed += R;
+
+    if (!Removed)
+        return PreservedAnalyses::all();
+
+    // the report goes to the standard error, so that it does not mix with the module printed by opt -S
+    errs() << "[CodeHoisting]\t" << F.getName() << ": " << Removed - Hoisted << " instructions removed ("
+           << Hoisted << " expressions hoisted, " << Removed << " copies replaced)\n";
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+}
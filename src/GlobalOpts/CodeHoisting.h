@@ -0,0 +1,17 @@
+#ifndef LLVM_TRANSFORMS_CODEHOISTING_H
+#define LLVM_TRANSFORMS_CODEHOISTING_H
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm
+{
+    /**
+     * Hoisting of the very busy expressions, see README.md.
+    */
+    class CodeHoisting : public PassInfoMixin<CodeHoisting>
+    {
+    public:
+        PreservedAnalyses run (Function &F, FunctionAnalysisManager &AM);
+    };
+} // namespace llvm
+#endif // LLVM_TRANSFORMS_CODEHOISTING_H
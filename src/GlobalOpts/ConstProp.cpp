@@ -0,0 +1,372 @@
+#include "llvm/Transforms/Utils/ConstProp.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+// #define DEBUG
+
+using namespace llvm;
+
+/**
+ * Element of the lattice of a value: Undef (no value seen yet) is above every constant, which is above
+ * Overdefined (not a constant). A value only moves down in the lattice.
+*/
+struct LatticeValue
+{
+    enum State { Undef, Const, Overdefined };
+
+    State Kind = Undef;
+    Constant *C = nullptr;
+};
+
+/**
+ * Solver of the sparse conditional constant propagation (Wegman-Zadeck).
+ * Constants are propagated over the def-use edges, and a block is evaluated only when an edge leading to it is
+ * found to be executable: the edges of a branch on a constant condition other than the taken one are never
+ * executed, hence the values flowing through them are ignored by the phis.
+*/
+class ConstPropSolver
+{
+    const DataLayout &DL;
+    DenseMap<Value*, LatticeValue> Lattice;
+    SmallPtrSet<BasicBlock*, 32> Executable;
+    DenseSet<std::pair<BasicBlock*, BasicBlock*>> ExecutableEdges;
+    SmallVector<BasicBlock*, 32> BlockWorklist;
+    SmallVector<Instruction*, 64> InstWorklist;
+
+    void pushUsers (Instruction *I)
+    {
+        for (User *U : I->users())
+        {
+            Instruction *UI = cast<Instruction>(U);
+            if (Executable.count(UI->getParent()))
+                InstWorklist.push_back(UI);
+        }
+    }
+
+    void markConstant (Instruction *I, Constant *C)
+    {
+        LatticeValue &LV = Lattice[I];
+        if (LV.Kind == LatticeValue::Const && LV.C != C)
+        {
+            markOverdefined(I);
+            return;
+        }
+        if (LV.Kind != LatticeValue::Undef)
+            return;
+        LV.Kind = LatticeValue::Const;
+        LV.C = C;
+        pushUsers(I);
+    }
+
+    void markOverdefined (Instruction *I)
+    {
+        LatticeValue &LV = Lattice[I];
+        if (LV.Kind == LatticeValue::Overdefined)
+            return;
+        LV.Kind = LatticeValue::Overdefined;
+        LV.C = nullptr;
+        pushUsers(I);
+    }
+
+    /**
+     * Move an instruction to the meet of its current lattice value and LV.
+    */
+    void mergeIn (Instruction *I, const LatticeValue &LV)
+    {
+        if (LV.Kind == LatticeValue::Const)
+            markConstant(I, LV.C);
+        else if (LV.Kind == LatticeValue::Overdefined)
+            markOverdefined(I);
+    }
+
+    void markEdgeExecutable (BasicBlock *From, BasicBlock *To)
+    {
+        if (!ExecutableEdges.insert({From, To}).second)
+            return;
+
+        if (Executable.insert(To).second)
+        {
+            BlockWorklist.push_back(To);
+            return;
+        }
+        // the block has already been evaluated, only its phis see a new incoming value
+        for (PHINode &Phi : To->phis())
+            InstWorklist.push_back(&Phi);
+    }
+
+    void visitPHINode (PHINode &Phi)
+    {
+        LatticeValue Result;
+        for (unsigned i = 0; i < Phi.getNumIncomingValues(); i++)
+        {
+            if (!ExecutableEdges.count({Phi.getIncomingBlock(i), Phi.getParent()}))
+                continue;
+
+            Value *V = Phi.getIncomingValue(i);
+            if (isa<UndefValue>(V))
+                continue;
+            LatticeValue LV = getValue(V);
+            if (LV.Kind == LatticeValue::Overdefined
+                || (LV.Kind == LatticeValue::Const && Result.Kind == LatticeValue::Const && LV.C != Result.C))
+            {
+                markOverdefined(&Phi);
+                return;
+            }
+            if (LV.Kind == LatticeValue::Const)
+                Result = LV;
+        }
+        mergeIn(&Phi, Result);
+    }
+
+    void visitTerminator (Instruction &I)
+    {
+        BasicBlock *B = I.getParent();
+        Value *Condition = nullptr;
+        if (BranchInst *BI = dyn_cast<BranchInst>(&I))
+            Condition = BI->isConditional() ? BI->getCondition() : nullptr;
+        else if (SwitchInst *SI = dyn_cast<SwitchInst>(&I))
+            Condition = SI->getCondition();
+
+        if (!Condition)
+        {
+            for (BasicBlock *S : successors(B))
+                markEdgeExecutable(B, S);
+            return;
+        }
+
+        LatticeValue LV = getValue(Condition);
+        // the condition is not known yet, no edge is executed until it is
+        if (LV.Kind == LatticeValue::Undef)
+            return;
+
+        ConstantInt *CI = LV.Kind == LatticeValue::Const ? dyn_cast<ConstantInt>(LV.C) : nullptr;
+        if (!CI)
+        {
+            for (BasicBlock *S : successors(B))
+                markEdgeExecutable(B, S);
+            return;
+        }
+
+        if (BranchInst *BI = dyn_cast<BranchInst>(&I))
+            markEdgeExecutable(B, BI->getSuccessor(CI->isZero() ? 1 : 0));
+        else
+            markEdgeExecutable(B, cast<SwitchInst>(&I)->findCaseValue(CI)->getCaseSuccessor());
+    }
+
+    void visitSelectInst (SelectInst &Select)
+    {
+        LatticeValue Condition = getValue(Select.getCondition());
+        if (Condition.Kind == LatticeValue::Undef)
+            return;
+
+        LatticeValue TrueValue = getValue(Select.getTrueValue());
+        LatticeValue FalseValue = getValue(Select.getFalseValue());
+        ConstantInt *CI = Condition.Kind == LatticeValue::Const ? dyn_cast<ConstantInt>(Condition.C) : nullptr;
+        if (CI)
+        {
+            mergeIn(&Select, CI->isZero() ? FalseValue : TrueValue);
+            return;
+        }
+
+        // the condition is not a constant, but both the operands may be the same constant
+        if (TrueValue.Kind == LatticeValue::Const && FalseValue.Kind == LatticeValue::Const && TrueValue.C == FalseValue.C)
+            markConstant(&Select, TrueValue.C);
+        else if (TrueValue.Kind == LatticeValue::Overdefined || FalseValue.Kind == LatticeValue::Overdefined
+            || (TrueValue.Kind == LatticeValue::Const && FalseValue.Kind == LatticeValue::Const))
+            markOverdefined(&Select);
+    }
+
+    void visit (Instruction &I)
+    {
+        if (PHINode *Phi = dyn_cast<PHINode>(&I))
+            return visitPHINode(*Phi);
+        if (I.isTerminator())
+        {
+            visitTerminator(I);
+            if (!I.getType()->isVoidTy())
+                markOverdefined(&I);
+            return;
+        }
+        if (I.getType()->isVoidTy())
+            return;
+        if (SelectInst *Select = dyn_cast<SelectInst>(&I))
+            return visitSelectInst(*Select);
+
+        // memory accesses and calls are not folded
+        if (I.mayReadOrWriteMemory() || isa<CallBase>(I) || I.isEHPad())
+            return markOverdefined(&I);
+
+        SmallVector<Constant*, 4> Operands;
+        for (Value *V : I.operands())
+        {
+            LatticeValue LV = getValue(V);
+            if (LV.Kind == LatticeValue::Overdefined)
+                return markOverdefined(&I);
+            // an operand is not known yet
+            if (LV.Kind == LatticeValue::Undef)
+                return;
+            Operands.push_back(LV.C);
+        }
+
+        Constant *C = nullptr;
+        if (CmpInst *Cmp = dyn_cast<CmpInst>(&I))
+            C = ConstantFoldCompareInstOperands(Cmp->getPredicate(), Operands[0], Operands[1], DL);
+        else
+            C = ConstantFoldInstOperands(&I, Operands, DL);
+
+        if (C)
+            markConstant(&I, C);
+        else
+            markOverdefined(&I);
+    }
+
+    void propagate ()
+    {
+        while (!BlockWorklist.empty() || !InstWorklist.empty())
+        {
+            while (!InstWorklist.empty())
+            {
+                Instruction *I = InstWorklist.pop_back_val();
+                visit(*I);
+            }
+            while (!BlockWorklist.empty())
+            {
+                BasicBlock *B = BlockWorklist.pop_back_val();
+                for (Instruction &I : *B)
+                    visit(I);
+            }
+        }
+    }
+
+    /**
+     * Mark as overdefined the conditions still unknown of the executed branches, which would otherwise have no
+     * successor executed (e.g. a condition depending on itself through a loop).
+     *
+     * @return true if a condition has been changed
+    */
+    bool resolveUnknownConditions (Function &F)
+    {
+        bool Changed = false;
+        for (BasicBlock &B : F)
+        {
+            if (!Executable.count(&B))
+                continue;
+            Instruction *T = B.getTerminator();
+            Value *Condition = nullptr;
+            if (BranchInst *BI = dyn_cast<BranchInst>(T))
+                Condition = BI->isConditional() ? BI->getCondition() : nullptr;
+            else if (SwitchInst *SI = dyn_cast<SwitchInst>(T))
+                Condition = SI->getCondition();
+
+            if (Condition && getValue(Condition).Kind == LatticeValue::Undef)
+            {
+                markOverdefined(cast<Instruction>(Condition));
+                InstWorklist.push_back(T);
+                Changed = true;
+            }
+        }
+        return Changed;
+    }
+
+public:
+    ConstPropSolver (Function &F) : DL(F.getParent()->getDataLayout()) {}
+
+    LatticeValue getValue (Value *V) const
+    {
+        LatticeValue LV;
+        if (Constant *C = dyn_cast<Constant>(V))
+        {
+            LV.Kind = LatticeValue::Const;
+            LV.C = C;
+        }
+        else if (isa<Instruction>(V))
+            LV = Lattice.lookup(V);
+        else
+            // arguments may have any value
+            LV.Kind = LatticeValue::Overdefined;
+        return LV;
+    }
+
+    bool isExecutable (BasicBlock *B) const { return Executable.count(B); }
+
+    void solve (Function &F)
+    {
+        Executable.insert(&F.getEntryBlock());
+        BlockWorklist.push_back(&F.getEntryBlock());
+        do
+            propagate();
+        while (resolveUnknownConditions(F));
+    }
+};
+
+/** @brief Sparse conditional constant propagation.
+ * The instructions found to be constants are replaced by their constant, the branches on constant conditions are
+ * replaced by unconditional branches, and the blocks which are never executed are deleted.
+ *
+ * @param F function
+ * @param AM function analysis manager
+*/
+PreservedAnalyses ConstProp::run (Function &F, FunctionAnalysisManager &AM)
+{
+    if (F.isDeclaration())
+        return PreservedAnalyses::all();
+
+    ConstPropSolver Solver(F);
+    Solver.solve(F);
+
+    unsigned Replaced = 0, FoldedBranches = 0;
+    SmallVector<BasicBlock*, 8> DeadBlocks;
+
+    for (BasicBlock &B : F)
+    {
+        if (!Solver.isExecutable(&B))
+        {
+            DeadBlocks.push_back(&B);
+            continue;
+        }
+
+        for (Instruction &I : make_early_inc_range(B))
+        {
+            if (I.getType()->isVoidTy() || I.isTerminator())
+                continue;
+            LatticeValue LV = Solver.getValue(&I);
+            if (LV.Kind != LatticeValue::Const)
+                continue;
+
+            #ifdef DEBUG
+                outs() << "[ConstProp]\tReplacing " << I << " with " << *LV.C << "\n";
+            #endif
+
+            I.replaceAllUsesWith(LV.C);
+            if (isInstructionTriviallyDead(&I))
+                I.eraseFromParent();
+            Replaced++;
+        }
+
+        if (ConstantFoldTerminator(&B, true))
+            FoldedBranches++;
+    }
+
+    // after the branches have been folded, the blocks never executed are not reachable anymore
+    DeleteDeadBlocks(DeadBlocks);
+
+    #ifdef DEBUG
+        outs() << "[ConstProp]\t" << F.getName() << ": " << Replaced << " constants, " << FoldedBranches
+               << " branches folded, " << DeadBlocks.size() << " blocks deleted\n";
+    #endif
+
+    if (FoldedBranches || !DeadBlocks.empty())
+        return PreservedAnalyses::none();
+    if (!Replaced)
+        return PreservedAnalyses::all();
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+}
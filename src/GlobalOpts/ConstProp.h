@@ -0,0 +1,17 @@
+#ifndef LLVM_TRANSFORMS_CONSTPROP_H
+#define LLVM_TRANSFORMS_CONSTPROP_H
+
+#include "llvm/IR/PassManager.h"
+
+namespace llvm
+{
+    /**
+     * Sparse conditional constant propagation on SSA form, see README.md.
+    */
+    class ConstProp : public PassInfoMixin<ConstProp>
+    {
+    public:
+        PreservedAnalyses run (Function &F, FunctionAnalysisManager &AM);
+    };
+} // namespace llvm
+#endif // LLVM_TRANSFORMS_CONSTPROP_H
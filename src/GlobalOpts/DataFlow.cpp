@@ -0,0 +1,279 @@
+#include "llvm/Transforms/Utils/DataFlow.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+static cl::opt<bool> DataFlowStatsOnly("dataflow-stats-only", cl::init(false),
+    cl::desc("Print only the number of blocks visited by each data flow analysis, instead of the sets"));
+
+VeryBusyExpressions::VeryBusyExpressions (Function &F)
+{
+    // expressions using each value as an operand, killed by the definition of the value
+    DenseMap<const Value*, SmallVector<unsigned, 4>> UsedBy;
+
+    for (Instruction &I : instructions(F))
+    {
+        BinaryOperator *BO = dyn_cast<BinaryOperator>(&I);
+        if (!BO)
+            continue;
+
+        auto [It, New] = Numbering.try_emplace(std::make_tuple(BO->getOpcode(), BO->getOperand(0), BO->getOperand(1)),
+                                               Expressions.size());
+        if (New)
+        {
+            Expressions.emplace_back();
+            for (Value *Op : BO->operands())
+                if (!isa<Constant>(Op))
+                    UsedBy[Op].push_back(It->second);
+        }
+        Expressions[It->second].push_back(BO);
+    }
+    DomainSize = Expressions.size();
+
+    // Gen and Kill are computed visiting the instructions from the last one: an expression is generated if it is
+    // computed before any of its operands is defined in the block
+    for (BasicBlock &B : F)
+    {
+        BitVector Gen(DomainSize), Kill(DomainSize);
+        for (Instruction &I : reverse(B))
+        {
+            auto It = UsedBy.find(&I);
+            if (It != UsedBy.end())
+            {
+                for (unsigned E : It->second)
+                {
+                    Gen.reset(E);
+                    Kill.set(E);
+                }
+            }
+
+            int E = getExpression(I);
+            if (E >= 0)
+                Gen.set(E);
+        }
+        GenKill[&B] = {std::move(Gen), std::move(Kill)};
+    }
+}
+
+int VeryBusyExpressions::getExpression (const Instruction &I) const
+{
+    const BinaryOperator *BO = dyn_cast<BinaryOperator>(&I);
+    if (!BO)
+        return -1;
+    auto It = Numbering.find(std::make_tuple(BO->getOpcode(), BO->getOperand(0), BO->getOperand(1)));
+    return It == Numbering.end() ? -1 : It->second;
+}
+
+DominatorAnalysis::DominatorAnalysis (Function &F)
+{
+    // reachable blocks are numbered in reverse post order, unreachable ones at the end
+    for (BasicBlock *B : ReversePostOrderTraversal<Function*>(&F))
+    {
+        Numbering[B] = Blocks.size();
+        Blocks.push_back(B);
+    }
+    for (BasicBlock &B : F)
+    {
+        if (Numbering.try_emplace(&B, Blocks.size()).second)
+            Blocks.push_back(&B);
+    }
+    DomainSize = Blocks.size();
+
+    // every block generates itself, and no block is killed
+    for (BasicBlock &B : F)
+    {
+        BitVector Gen(DomainSize), Kill(DomainSize);
+        Gen.set(Numbering[&B]);
+        GenKill[&B] = {std::move(Gen), std::move(Kill)};
+    }
+}
+
+ConstantPropagation::ConstantPropagation (Function &F) : DL(F.getParent()->getDataLayout())
+{
+    for (Instruction &I : instructions(F))
+    {
+        if (I.getType()->isVoidTy())
+            continue;
+        Numbering[&I] = Values.size();
+        Values.push_back(&I);
+    }
+}
+
+/** @brief Evaluate an instruction, given the set of the values which are constants before it.
+ * A phi is a constant if all its incoming values are the same constant; the incoming values which are not
+ * evaluated yet (coming from back edges) and undef values are ignored, since they do not prevent it to be constant.
+ *
+ * @param I the instruction
+ * @param Set the values which are constants before I
+ * @return the constant value of I, nullptr if it is not a constant
+*/
+Constant *ConstantPropagation::evaluate (Instruction &I, const BitVector &Set)
+{
+    if (PHINode *Phi = dyn_cast<PHINode>(&I))
+    {
+        Constant *Result = nullptr;
+        for (Value *V : Phi->incoming_values())
+        {
+            if (V == Phi || isa<UndefValue>(V) || (Numbering.count(V) && !Table.count(V)))
+                continue;
+            Constant *C = isa<Constant>(V) ? cast<Constant>(V) : Table.lookup(V);
+            if (!C || (Result && C != Result))
+                return nullptr;
+            Result = C;
+        }
+        return Result;
+    }
+
+    // memory accesses and calls are not folded
+    if (I.mayReadOrWriteMemory() || isa<CallBase>(I) || I.isTerminator())
+        return nullptr;
+
+    SmallVector<Constant*, 4> Operands;
+    for (Value *V : I.operands())
+    {
+        Constant *C = dyn_cast<Constant>(V);
+        if (!C)
+        {
+            auto It = Numbering.find(V);
+            if (It == Numbering.end() || !Set.test(It->second))
+                return nullptr;
+            C = Table.lookup(V);
+        }
+        if (!C)
+            return nullptr;
+        Operands.push_back(C);
+    }
+
+    if (CmpInst *Cmp = dyn_cast<CmpInst>(&I))
+        return ConstantFoldCompareInstOperands(Cmp->getPredicate(), Operands[0], Operands[1], DL);
+    return ConstantFoldInstOperands(&I, Operands, DL);
+}
+
+/** @brief Transfer function of the constant propagation: each instruction kills the couple of the value it
+ * defines, and generates it if the value is a constant.
+ * The value of an instruction which has been found not to be a constant is never considered a constant again,
+ * so that the table only moves down in the lattice (not evaluated, constant, not constant) and the iteration ends.
+ *
+ * @param B the basic block
+ * @param Input in[B]
+ * @param Output out[B]
+ * @return true if out[B] or a constant of the table changed, false otherwise
+*/
+bool ConstantPropagation::transfer (BasicBlock &B, const BitVector &Input, BitVector &Output)
+{
+    BitVector Set = Input;
+    bool Changed = false;
+
+    for (Instruction &I : B)
+    {
+        auto It = Numbering.find(&I);
+        if (It == Numbering.end())
+            continue;
+
+        auto [Entry, New] = Table.try_emplace(&I, nullptr);
+        Constant *C = (New || Entry->second) ? evaluate(I, Set) : nullptr;
+        if (New || Entry->second != C)
+        {
+            Entry->second = C;
+            Changed = true;
+        }
+        Set[It->second] = C != nullptr;
+    }
+
+    if (Set != Output)
+    {
+        Output = std::move(Set);
+        Changed = true;
+    }
+    return Changed;
+}
+
+/**
+ * Print an element of a domain as the value it represents, without its definition.
+*/
+static void printValue (const Value *V)
+{
+    V->printAsOperand(outs(), false);
+}
+
+PreservedAnalyses DataFlowPrinter::run (Function &F, FunctionAnalysisManager &AM)
+{
+    if (F.isDeclaration())
+        return PreservedAnalyses::all();
+
+    outs() << "Function " << F.getName() << ": " << F.size() << " blocks\n";
+
+    VeryBusyExpressions VBE(F);
+    DataFlowSolver<VeryBusyExpressions> VBESolver(F, VBE);
+    VBESolver.solve();
+    outs() << "[VeryBusyExpressions]\t" << VBE.getDomainSize() << " expressions, "
+           << VBESolver.getNumVisits() << " blocks visited\n";
+    if (!DataFlowStatsOnly)
+    {
+        for (BasicBlock *B : VBESolver.getOrder())
+        {
+            outs() << "\t";
+            printValue(B);
+            outs() << ":";
+            for (unsigned E : VBESolver.getOut(B).set_bits())
+            {
+                BinaryOperator *BO = VBE.getInstructions(E).front();
+                outs() << " (" << BO->getOpcodeName() << " ";
+                printValue(BO->getOperand(0));
+                outs() << ", ";
+                printValue(BO->getOperand(1));
+                outs() << ")";
+            }
+            outs() << "\n";
+        }
+    }
+
+    DominatorAnalysis Dom(F);
+    DataFlowSolver<DominatorAnalysis> DomSolver(F, Dom);
+    DomSolver.solve();
+    outs() << "[DominatorAnalysis]\t" << Dom.getDomainSize() << " blocks, "
+           << DomSolver.getNumVisits() << " blocks visited\n";
+    if (!DataFlowStatsOnly)
+    {
+        for (BasicBlock *B : DomSolver.getOrder())
+        {
+            outs() << "\t";
+            printValue(B);
+            outs() << ":";
+            for (unsigned D : DomSolver.getOut(B).set_bits())
+            {
+                outs() << " ";
+                printValue(Dom.getBlock(D));
+            }
+            outs() << "\n";
+        }
+    }
+
+    ConstantPropagation CP(F);
+    DataFlowSolver<ConstantPropagation> CPSolver(F, CP);
+    CPSolver.solve();
+    outs() << "[ConstantPropagation]\t" << CP.getDomainSize() << " values, "
+           << CPSolver.getNumVisits() << " blocks visited\n";
+    if (!DataFlowStatsOnly)
+    {
+        for (BasicBlock *B : CPSolver.getOrder())
+        {
+            outs() << "\t";
+            printValue(B);
+            outs() << ":";
+            for (unsigned V : CPSolver.getOut(B).set_bits())
+            {
+                outs() << " (";
+                printValue(CP.getValue(V));
+                outs() << ", ";
+                printValue(CP.getConstant(CP.getValue(V)));
+                outs() << ")";
+            }
+            outs() << "\n";
+        }
+    }
+
+    return PreservedAnalyses::all();
+}
@@ -0,0 +1,282 @@
+#ifndef LLVM_TRANSFORMS_DATAFLOW_H
+#define LLVM_TRANSFORMS_DATAFLOW_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallVector.h"
+#include <functional>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+namespace llvm
+{
+    /**
+     * Direction of a data flow analysis (see DataFlowAnalysis/0.DataFlowAnalysis.md):
+     *  - Forward: in[B] = meet(out[p]) for all predecessors p, out[B] = f_B(in[B])
+     *  - Backward: out[B] = meet(in[s]) for all successors s, in[B] = f_B(out[B])
+    */
+    enum class DataFlowDirection { Forward, Backward };
+
+    /**
+     * Meet operator of a data flow analysis, it also determines the initial interior points:
+     * the universal set for the intersection, the empty set for the union.
+    */
+    enum class DataFlowMeet { Union, Intersection };
+
+    /** @brief Generic iterative solver of a data flow analysis on the basic blocks of a function.
+     * The elements of the domain are numbered by the analysis from 0 to getDomainSize() - 1, and every set is a
+     * dense BitVector indexed by that numbering.
+     *
+     * The analysis type must provide:
+     *  - static constexpr DataFlowDirection Direction and DataFlowMeet Meet
+     *  - unsigned getDomainSize() const
+     *  - BitVector getBoundary() const, the set flowing in the boundary blocks: it is in[entry] for forward
+     *    analyses and out[B] of the blocks without successors for backward analyses, so that the transfer
+     *    function is applied to the boundary blocks as well
+     *  - bool transfer(BasicBlock &B, const BitVector &Input, BitVector &Output), which computes the set on
+     *    the other side of B and returns true if it changed (or if the analysis changed some state of its own
+     *    which the successors in the flow depend on)
+     *
+     * Blocks are visited through a worklist ordered by reverse post order (post order for backward analyses), so
+     * that a block is visited after the blocks flowing into it, and a block is visited again only when its input
+     * changes. Blocks unreachable from the entry are not visited and keep the initial interior sets.
+    */
+    template <typename AnalysisT>
+    class DataFlowSolver
+    {
+        static constexpr bool Forward = AnalysisT::Direction == DataFlowDirection::Forward;
+
+        AnalysisT &Analysis;
+        // blocks in reverse post order, and position of each block in the order
+        SmallVector<BasicBlock*, 32> Order;
+        DenseMap<const BasicBlock*, unsigned> Index;
+        // in and out sets of the blocks, indexed by the position of the block in the order
+        std::vector<BitVector> In, Out;
+        // number of transfer functions applied, i.e. of blocks visited
+        unsigned Visits = 0;
+
+        /**
+         * Compute the input of a block applying the meet operator to the sets of its neighbours in the flow
+         * (predecessors for forward analyses, successors for backward analyses).
+        */
+        void meet (const BasicBlock *B, BitVector &Input) const
+        {
+            bool Boundary = true;
+            auto meetWith = [&] (const BasicBlock *N)
+            {
+                auto It = Index.find(N);
+                if (It == Index.end())
+                    return;
+                const BitVector &Set = Forward ? Out[It->second] : In[It->second];
+                if (Boundary)
+                    Input = Set;
+                else if (AnalysisT::Meet == DataFlowMeet::Intersection)
+                    Input &= Set;
+                else
+                    Input |= Set;
+                Boundary = false;
+            };
+
+            if (Forward)
+            {
+                if (B != &B->getParent()->getEntryBlock())
+                    for (const BasicBlock *P : predecessors(B))
+                        meetWith(P);
+            }
+            else
+            {
+                for (const BasicBlock *S : successors(B))
+                    meetWith(S);
+            }
+
+            if (Boundary)
+                Input = Analysis.getBoundary();
+        }
+
+    public:
+        DataFlowSolver (Function &F, AnalysisT &Analysis) : Analysis(Analysis)
+        {
+            for (BasicBlock *B : ReversePostOrderTraversal<Function*>(&F))
+            {
+                Index[B] = Order.size();
+                Order.push_back(B);
+            }
+
+            BitVector Initial(Analysis.getDomainSize(), AnalysisT::Meet == DataFlowMeet::Intersection);
+            In.assign(Order.size(), Initial);
+            Out.assign(Order.size(), Initial);
+        }
+
+        /**
+         * Iterate the transfer functions until no set changes.
+        */
+        void solve ()
+        {
+            // positions are popped from the lowest, hence backward analyses store them mirrored
+            auto toQueue = [this] (unsigned Pos) { return Forward ? Pos : Order.size() - 1 - Pos; };
+            std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>> Worklist;
+            BitVector Queued(Order.size(), true);
+            for (unsigned Pos = 0; Pos < Order.size(); Pos++)
+                Worklist.push(Pos);
+
+            BitVector Input;
+            while (!Worklist.empty())
+            {
+                unsigned Pos = toQueue(Worklist.top());
+                Worklist.pop();
+                Queued.reset(Pos);
+                BasicBlock *B = Order[Pos];
+
+                meet(B, Input);
+                BitVector &Output = Forward ? Out[Pos] : In[Pos];
+                (Forward ? In[Pos] : Out[Pos]) = Input;
+                Visits++;
+                if (!Analysis.transfer(*B, Input, Output))
+                    continue;
+
+                auto enqueue = [&] (const BasicBlock *N)
+                {
+                    auto It = Index.find(N);
+                    if (It != Index.end() && !Queued.test(It->second))
+                    {
+                        Queued.set(It->second);
+                        Worklist.push(toQueue(It->second));
+                    }
+                };
+                if (Forward)
+                    for (const BasicBlock *S : successors(B))
+                        enqueue(S);
+                else
+                    for (const BasicBlock *P : predecessors(B))
+                        enqueue(P);
+            }
+        }
+
+        bool isReachable (const BasicBlock *B) const { return Index.count(B); }
+        const BitVector &getIn (const BasicBlock *B) const { return In[Index.lookup(B)]; }
+        const BitVector &getOut (const BasicBlock *B) const { return Out[Index.lookup(B)]; }
+        ArrayRef<BasicBlock*> getOrder () const { return Order; }
+        unsigned getNumVisits () const { return Visits; }
+    };
+
+    /**
+     * Base of the analyses whose transfer function is f_B(x) = Gen_B ∪ (x - Kill_B), with Gen and Kill computed
+     * once per block.
+    */
+    class GenKillAnalysis
+    {
+    protected:
+        unsigned DomainSize = 0;
+        DenseMap<const BasicBlock*, std::pair<BitVector, BitVector>> GenKill;
+
+    public:
+        unsigned getDomainSize () const { return DomainSize; }
+        BitVector getBoundary () const { return BitVector(DomainSize); }
+
+        bool transfer (BasicBlock &B, const BitVector &Input, BitVector &Output)
+        {
+            const auto &[Gen, Kill] = GenKill.find(&B)->second;
+            BitVector Result = Input;
+            Result.reset(Kill);
+            Result |= Gen;
+            if (Result == Output)
+                return false;
+            Output = std::move(Result);
+            return true;
+        }
+    };
+
+    /** @brief Very busy expressions (see DataFlowAnalysis/1.VeryBusyExpressions.md).
+     * An expression is very busy at a point if it is evaluated on every path from that point before any of its
+     * operands is redefined; the domain is the set of binary expressions of the function, where the same opcode
+     * applied to the same operands is the same expression wherever it is computed.
+    */
+    class VeryBusyExpressions : public GenKillAnalysis
+    {
+        // the binary instructions computing each expression, in program order
+        SmallVector<SmallVector<BinaryOperator*, 2>, 32> Expressions;
+        DenseMap<std::tuple<unsigned, Value*, Value*>, unsigned> Numbering;
+
+    public:
+        static constexpr DataFlowDirection Direction = DataFlowDirection::Backward;
+        static constexpr DataFlowMeet Meet = DataFlowMeet::Intersection;
+
+        VeryBusyExpressions (Function &F);
+
+        /**
+         * Get the number of an expression, -1 if the instruction is not an expression of the domain.
+        */
+        int getExpression (const Instruction &I) const;
+        ArrayRef<BinaryOperator*> getInstructions (unsigned Expression) const { return Expressions[Expression]; }
+    };
+
+    /** @brief Dominator analysis (see DataFlowAnalysis/2.DominatorAnalysis.md).
+     * The domain is the set of the blocks of the function, numbered in reverse post order; DOM[B] = out[B].
+    */
+    class DominatorAnalysis : public GenKillAnalysis
+    {
+        SmallVector<const BasicBlock*, 32> Blocks;
+        DenseMap<const BasicBlock*, unsigned> Numbering;
+
+    public:
+        static constexpr DataFlowDirection Direction = DataFlowDirection::Forward;
+        static constexpr DataFlowMeet Meet = DataFlowMeet::Intersection;
+
+        DominatorAnalysis (Function &F);
+
+        unsigned getNumber (const BasicBlock *B) const { return Numbering.lookup(B); }
+        const BasicBlock *getBlock (unsigned Number) const { return Blocks[Number]; }
+    };
+
+    /** @brief Constant propagation (see DataFlowAnalysis/3.ConstantPropagation.md).
+     * The domain has an element for each instruction defining a value: the bit of the value is set at a point
+     * if the value is a constant there, and the constant is kept in a table. In SSA form a value has a single
+     * definition, hence the table has a single entry for each value.
+     * Gen and Kill are computed while applying the transfer function, by folding the instructions whose operands
+     * are constants; the operands of a phi which are not computed yet are optimistically ignored.
+    */
+    class ConstantPropagation
+    {
+        const DataLayout &DL;
+        SmallVector<Instruction*, 64> Values;
+        DenseMap<const Value*, unsigned> Numbering;
+        // the constant of each value, nullptr if the value is not a constant; values not evaluated yet are absent
+        DenseMap<const Value*, Constant*> Table;
+
+        Constant *evaluate (Instruction &I, const BitVector &Set);
+
+    public:
+        static constexpr DataFlowDirection Direction = DataFlowDirection::Forward;
+        static constexpr DataFlowMeet Meet = DataFlowMeet::Intersection;
+
+        ConstantPropagation (Function &F);
+
+        unsigned getDomainSize () const { return Values.size(); }
+        BitVector getBoundary () const { return BitVector(Values.size()); }
+        bool transfer (BasicBlock &B, const BitVector &Input, BitVector &Output);
+
+        /**
+         * Get the constant value of an instruction, nullptr if it is not a constant.
+        */
+        Constant *getConstant (const Value *V) const { return Table.lookup(V); }
+        unsigned getNumber (const Value *V) const { return Numbering.lookup(V); }
+        Instruction *getValue (unsigned Number) const { return Values[Number]; }
+    };
+
+    /**
+     * Print the results of very busy expressions, dominator analysis and constant propagation on each function.
+    */
+    class DataFlowPrinter : public PassInfoMixin<DataFlowPrinter>
+    {
+    public:
+        PreservedAnalyses run (Function &F, FunctionAnalysisManager &AM);
+    };
+}
+
+#endif // LLVM_TRANSFORMS_DATAFLOW_H
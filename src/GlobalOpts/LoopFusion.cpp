@@ -1,28 +1,92 @@
 #include "llvm/Transforms/Utils/LoopFusion.h"
 #include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/PatternMatch.h"
 #include <llvm/IR/Dominators.h>
 #include <llvm/Analysis/PostDominators.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/DependenceAnalysis.h>
+#include <llvm/Analysis/DomTreeUpdater.h>
 #include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <functional>
+#include <numeric>
 
 
 // #define DEBUG
 
 using namespace llvm;
 
+static cl::opt<unsigned> LoopFusionMinSavedMisses("loopfusion-min-saved-misses", cl::init(0),
+    cl::desc("Minimum percentage of the cache misses that a fusion must save to be profitable"));
+
+static cl::opt<unsigned> LoopFusionCacheSize("loopfusion-cache-size", cl::init(32768),
+    cl::desc("Size in bytes of the data cache assumed by the fusion cost model, if the target does not provide it"));
+
+
+/** @brief Returns true if an instruction between two loops may access the same memory of a loop.
+ * A load conflicts with the writes of the loop, a store with any access of the loop.
+ * 
+ * @param inst instruction
+ * @param l loop
+ * @param AA alias analysis
+ * @return bool
+*/
+bool mayConflictWithLoop (Instruction *inst, Loop *l, AAResults &AA)
+{
+    if (!inst->mayReadOrWriteMemory())
+        return false;
+
+    MemoryLocation location = MemoryLocation::get(inst);
+    for (BasicBlock *BB : l->blocks())
+    {
+        for (Instruction &loop_inst : *BB)
+        {
+            if (!loop_inst.mayReadOrWriteMemory())
+                continue;
+
+            ModRefInfo info = AA.getModRefInfo(&loop_inst, location);
+            if (isa<StoreInst>(inst) ? isModOrRefSet(info) : isModSet(info))
+                return true;
+        }
+    }
+    return false;
+}
+
 
 /** Returns true if the loops are adjacent, i.e. the exit block of the first loop is the preheader 
- * of the second one (or the guard block if the loop is guarded). Otherwise, it returns false.
+ * of the second one. Otherwise, it returns false.
+ * The instructions in the exit block are moved out of the way when possible: an instruction is hoisted to the
+ * preheader of the first loop if its operands are available there and it does not access the memory of the first
+ * loop, otherwise it is sunk to the exit block of the second loop if it is not used by the second loop and it does
+ * not access the memory of the second loop. Only the instructions without side effects, and the simple loads and
+ * stores, are moved.
+ * The loops are adjacent if every instruction can be moved; the instructions are moved by moveInterveningCode.
  * 
  * @param l1 loop 1
  * @param l2 loop 2
+ * @param AA alias analysis
+ * @param DT dominator tree
+ * @param hoisted filled with the instructions to hoist, in program order
+ * @param sunk filled with the instructions to sink, in program order
  * @return bool
 */
-bool areAdjacent (Loop *l1, Loop *l2)
+bool areAdjacent (Loop *l1, Loop *l2, AAResults &AA, DominatorTree &DT, SmallVectorImpl<Instruction*> &hoisted,
+                  SmallVectorImpl<Instruction*> &sunk)
 {
+    // a guarded loop is rotated, which the fusion does not support (see haveFusibleStructure)
+    if (l2->isGuarded())
+    {
+        outs() << "Second Loop is guarded, can't perform fusion\n";
+        return false;
+    }
+
     // check for all the exit blocks of l1
     SmallVector<BasicBlock*, 4> exit_blocks;
 
@@ -30,24 +94,126 @@ bool areAdjacent (Loop *l1, Loop *l2)
 
     for (BasicBlock *BB : exit_blocks)
     {
-        if (l2->isGuarded() && BB != dyn_cast<BasicBlock>(l2->getLoopGuardBranch()))
+        if (BB != l2->getLoopPreheader())
+        {
+            outs() << "exit block of first loop is not equal to entry block of second loop\n";
+            return false;
+        }
+    }
+
+    BasicBlock *BB = l2->getLoopPreheader();
+    if (BB->size() == 1)
+        return true;
+
+    // the moved instructions must be executed on the same paths
+    BasicBlock *l1_preheader = l1->getLoopPreheader();
+    BasicBlock *l2_exit = l2->getExitBlock();
+    if (!l1_preheader || !l2_exit || !BB->getSinglePredecessor() || l2_exit->getSinglePredecessor() != l2->getHeader())
+    {
+        outs() << "there are instructions between the loops\n";
+        return false;
+    }
+
+    SmallPtrSet<Instruction*, 8> hoisted_set;
+    SmallVector<Instruction*, 8> remaining;
+    for (Instruction &inst : *BB)
+    {
+        if (inst.isTerminator())
+            break;
+
+        bool is_simple_access = (isa<LoadInst>(inst) && cast<LoadInst>(inst).isSimple()) ||
+                                (isa<StoreInst>(inst) && cast<StoreInst>(inst).isSimple());
+        if (isa<PHINode>(inst) || isa<AllocaInst>(inst) || 
+            (inst.mayReadOrWriteMemory() ? !is_simple_access : inst.mayHaveSideEffects()))
         {
-            outs() << "Second Loop is guarded, exit block of first loop is not equal to entry block of second loop";
+            outs() << "there are instructions between the loops that can't be moved\n";
             return false;
         }
 
-        if (BB != l2->getLoopPreheader() || BB->size() > 1)
+        bool can_hoist = !mayConflictWithLoop(&inst, l1, AA);
+        for (Value *operand : inst.operands())
+        {
+            Instruction *op_inst = dyn_cast<Instruction>(operand);
+            if (op_inst && !hoisted_set.count(op_inst) && !DT.dominates(op_inst, l1_preheader->getTerminator()))
+                can_hoist = false;
+        }
+        // the instructions left behind are executed after the hoisted ones
+        for (Instruction *previous : remaining)
+        {
+            if (!can_hoist)
+                break;
+            if ((inst.mayWriteToMemory() && previous->mayReadOrWriteMemory()) ||
+                (inst.mayReadFromMemory() && previous->mayWriteToMemory()))
+            {
+                ModRefInfo info = AA.getModRefInfo(previous, MemoryLocation::get(&inst));
+                can_hoist = isa<StoreInst>(inst) ? isNoModRef(info) : !isModSet(info);
+            }
+        }
+
+        if (can_hoist)
         {
-            outs() << "exit block of first loop is not equal to entry block of second loop or there are instructions between the loops";
+            hoisted.push_back(&inst);
+            hoisted_set.insert(&inst);
+        }
+        else
+            remaining.push_back(&inst);
+    }
+
+    // the remaining instructions are sunk, their users must either be sunk as well or follow the second loop
+    SmallPtrSet<Instruction*, 8> sunk_set;
+    for (Instruction *inst : reverse(remaining))
+    {
+        if (mayConflictWithLoop(inst, l2, AA))
+        {
+            outs() << "there are instructions between the loops that can't be moved\n";
             return false;
         }
+
+        for (User *user : inst->users())
+        {
+            Instruction *user_inst = cast<Instruction>(user);
+            if (!sunk_set.count(user_inst) && 
+                (isa<PHINode>(user_inst) || !DT.dominates(l2_exit, user_inst->getParent())))
+            {
+                outs() << "there are instructions between the loops used by the second loop\n";
+                return false;
+            }
+        }
+        sunk_set.insert(inst);
     }
+    sunk.append(remaining.begin(), remaining.end());
     return true;
 }
 
 
+/** @brief Move the instructions between two adjacent loops out of the way (see areAdjacent).
+ * 
+ * @param l1 loop 1
+ * @param l2 loop 2
+ * @param hoisted the instructions to hoist to the preheader of the first loop
+ * @param sunk the instructions to sink to the exit block of the second loop
+*/
+void moveInterveningCode (Loop *l1, Loop *l2, ArrayRef<Instruction*> hoisted, ArrayRef<Instruction*> sunk)
+{
+    Instruction *hoist_point = l1->getLoopPreheader()->getTerminator();
+    for (Instruction *inst : hoisted)
+        inst->moveBefore(hoist_point);
+
+    if (!sunk.empty())
+    {
+        Instruction *sink_point = &*l2->getExitBlock()->getFirstInsertionPt();
+        for (Instruction *inst : sunk)
+            inst->moveBefore(sink_point);
+    }
+
+    if (!hoisted.empty() || !sunk.empty())
+        outs() << hoisted.size() << " instructions hoisted and " << sunk.size() << " sunk out of the loops\n";
+}
+
+
 /** @brief Returns true if the loops have the same number of iterations.
- * Otherwise, it returns false. The number of iterations is computed based on the number of backedges taken.
+ * Otherwise, it returns false. The number of iterations is computed based on the number of backedges taken, which
+ * are compared as expressions, so that counts formed in different ways are still recognized as equal.
  * 
  * @param l1 loop 1
  * @param l2 loop 2
@@ -70,7 +236,207 @@ bool haveSameIterationsNumber (Loop *l1, Loop *l2, ScalarEvolution *SE)
         return trip_count;
     };
 
-    return getTripCount(l1) == getTripCount(l2);
+    const SCEV *trip_count1 = getTripCount(l1);
+    const SCEV *trip_count2 = getTripCount(l2);
+    if (!trip_count1 || !trip_count2 || trip_count1->getType() != trip_count2->getType())
+        return false;
+    return trip_count1 == trip_count2 || SE->getMinusSCEV(trip_count1, trip_count2)->isZero();
+}
+
+
+/** @brief Get the exit condition of a loop in the form i < bound.
+ * The loop must exit from the header when the canonical induction variable i reaches a loop invariant bound,
+ * compared as signed or unsigned.
+ * 
+ * @param l loop
+ * @return ICmpInst *, nullptr if the condition is not in the form
+*/
+ICmpInst *getBoundCondition (Loop *l)
+{
+    BranchInst *branch = dyn_cast<BranchInst>(l->getHeader()->getTerminator());
+    PHINode *index = l->getCanonicalInductionVariable();
+    if (!branch || !branch->isConditional() || !index || !l->contains(branch->getSuccessor(0)))
+        return nullptr;
+
+    ICmpInst *condition = dyn_cast<ICmpInst>(branch->getCondition());
+    if (!condition || condition->getOperand(0) != index || !l->isLoopInvariant(condition->getOperand(1))
+        || (condition->getPredicate() != ICmpInst::ICMP_SLT && condition->getPredicate() != ICmpInst::ICMP_ULT))
+        return nullptr;
+    return condition;
+}
+
+
+/** @brief Returns true if a bound is known to be not greater than another one.
+ * Besides the relations proved by scalar evolution, a bound computed from the other one by subtracting (or adding)
+ * a non negative (non positive) constant without wrapping is not greater (e.g. n - 1 and n).
+ * 
+ * @param bound1 bound 1
+ * @param bound2 bound 2
+ * @param is_signed true if the bounds are compared as signed
+ * @param SE scalar evolution
+ * @return bool
+*/
+bool isNotGreater (Value *bound1, Value *bound2, bool is_signed, ScalarEvolution &SE)
+{
+    using namespace PatternMatch;
+
+    if (SE.isKnownPredicate(is_signed ? ICmpInst::ICMP_SLE : ICmpInst::ICMP_ULE, SE.getSCEV(bound1), SE.getSCEV(bound2)))
+        return true;
+
+    // the wrap flags of the instructions are not always transferred to scalar evolution
+    const APInt *C;
+    if (is_signed)
+        return (match(bound1, m_NSWSub(m_Specific(bound2), m_APInt(C))) && C->isNonNegative())
+            || (match(bound1, m_NSWAdd(m_Specific(bound2), m_APInt(C))) && !C->isStrictlyPositive())
+            || (match(bound2, m_NSWAdd(m_Specific(bound1), m_APInt(C))) && C->isNonNegative())
+            || (match(bound2, m_NSWSub(m_Specific(bound1), m_APInt(C))) && !C->isStrictlyPositive());
+    return match(bound1, m_NUWSub(m_Specific(bound2), m_APInt(C)))
+        || match(bound2, m_NUWAdd(m_Specific(bound1), m_APInt(C)));
+}
+
+
+/** @brief Get the loop executing more iterations, if its extra iterations can be peeled.
+ * The loops must exit when their induction variable reaches a bound (see getBoundCondition), with the same
+ * comparison, and the bound of one of them must be known to be not greater than the other one (see isNotGreater).
+ * The values of the longer loop must not be used after it, since its last iterations are moved to a copy of the loop
+ * (see peelExtraIterations), placed after the instructions sunk past the second loop.
+ * 
+ * @param l1 loop 1
+ * @param l2 loop 2
+ * @param SE scalar evolution
+ * @param DT dominator tree
+ * @param AA alias analysis
+ * @param hoisted the instructions hoisted before the first loop (see areAdjacent)
+ * @param sunk the instructions sunk after the second loop (see areAdjacent)
+ * @param short_bound set to the bound of the shorter loop
+ * @return Loop *, nullptr if the iterations cannot be peeled
+*/
+Loop *getLongerLoop (Loop *l1, Loop *l2, ScalarEvolution &SE, DominatorTree &DT, AAResults &AA,
+                     ArrayRef<Instruction*> hoisted, ArrayRef<Instruction*> sunk, Value *&short_bound)
+{
+    ICmpInst *condition1 = getBoundCondition(l1);
+    ICmpInst *condition2 = getBoundCondition(l2);
+    if (!condition1 || !condition2 || condition1->getPredicate() != condition2->getPredicate())
+    {
+        outs() << "Loops do not have the same number of iterations\n";
+        return nullptr;
+    }
+
+    Value *bound1 = condition1->getOperand(1);
+    Value *bound2 = condition2->getOperand(1);
+    bool is_signed = condition1->isSigned();
+
+    Loop *longer = nullptr;
+    if (isNotGreater(bound2, bound1, is_signed, SE))
+    {
+        longer = l1;
+        short_bound = bound2;
+    }
+    else if (isNotGreater(bound1, bound2, is_signed, SE))
+    {
+        longer = l2;
+        short_bound = bound1;
+    }
+    else
+    {
+        outs() << "The difference between the numbers of iterations is unknown\n";
+        return nullptr;
+    }
+
+    // the bound of the shorter loop is used by the longer one and by its copy after both the loops
+    Instruction *bound_inst = dyn_cast<Instruction>(short_bound);
+    if (bound_inst && !DT.dominates(bound_inst, l1->getHeader()) && !is_contained(hoisted, bound_inst))
+        return nullptr;
+
+    // the extra iterations of the first loop are moved after the instructions sunk past the second loop
+    if (longer == l1 && any_of(sunk, [l1, &AA] (Instruction *inst) { return mayConflictWithLoop(inst, l1, AA); }))
+    {
+        outs() << "Instructions between the loops access the memory of the first loop, can't peel the loop\n";
+        return nullptr;
+    }
+
+    for (BasicBlock *BB : longer->blocks())
+    {
+        for (Instruction &inst : *BB)
+        {
+            for (User *user : inst.users())
+            {
+                if (!longer->contains(cast<Instruction>(user)))
+                {
+                    outs() << "Values of the longer loop are used after it, can't peel the loop\n";
+                    return nullptr;
+                }
+            }
+        }
+    }
+    return longer;
+}
+
+
+/** @brief Peel the extra iterations of the longer loop of a pair, so that both the loops have the same bound.
+ * The longer loop is copied after both the loops, as an epilogue starting from the bound of the shorter loop,
+ * and the longer loop is limited to the same bound. An epilogue keeps the iterations paired by the fusion (a
+ * prologue would shift the induction variable of one of the loops); when the longer loop is the first one, its
+ * extra iterations are moved after the second loop, which is legal under the same conditions of the fusion (no
+ * iteration of the second loop depends on a later iteration of the first one).
+ * The dominator trees and the loop info are updated.
+ * 
+ * @param longer the longer loop
+ * @param l2 the second loop of the pair
+ * @param short_bound bound of the shorter loop
+ * @param LI loop info
+ * @param SE scalar evolution
+ * @param DT dominator tree
+ * @param DTU dominator trees updater
+*/
+void peelExtraIterations (Loop *longer, Loop *l2, Value *short_bound, LoopInfo &LI, ScalarEvolution &SE,
+                          DominatorTree &DT, DomTreeUpdater &DTU)
+{
+    SE.forgetLoop(longer);
+
+    // the preheader is copied with the loop, it must be empty
+    BasicBlock *preheader = longer->getLoopPreheader();
+    if (preheader->size() > 1)
+        SplitBlock(preheader, preheader->getTerminator(), &DTU, &LI);
+
+    // the epilogue is placed after the second loop
+    BasicBlock *last_header = l2->getHeader();
+    BasicBlock *exit_block = l2->getExitBlock();
+    BasicBlock *longer_exit_block = longer->getExitBlock();
+
+    ValueToValueMapTy VMap;
+    SmallVector<BasicBlock*, 8> epilogue_blocks;
+    Loop *epilogue = cloneLoopWithPreheader(exit_block, last_header, longer, VMap, ".epilogue", &LI, &DT,
+                                            epilogue_blocks);
+    remapInstructionsInBlocks(epilogue_blocks, VMap);
+
+    BasicBlock *epilogue_preheader = epilogue->getLoopPreheader();
+    BasicBlock *epilogue_header = epilogue->getHeader();
+
+    last_header->getTerminator()->replaceUsesOfWith(exit_block, epilogue_preheader);
+    epilogue_header->getTerminator()->replaceUsesOfWith(longer_exit_block, exit_block);
+    exit_block->replacePhiUsesWith(last_header, epilogue_header);
+
+    DTU.applyUpdates({{DominatorTree::Delete, last_header, exit_block},
+                      {DominatorTree::Insert, last_header, epilogue_preheader},
+                      {DominatorTree::Insert, epilogue_header, exit_block}});
+
+    // the epilogue starts where the shorter loop stops (the shorter loop may not be executed at all)
+    ICmpInst *condition = getBoundCondition(longer);
+    Value *start = short_bound;
+    if (condition->isSigned())
+    {
+        Constant *zero = ConstantInt::get(short_bound->getType(), 0);
+        Instruction *positive = new ICmpInst(epilogue_preheader->getTerminator(), ICmpInst::ICMP_SGT, short_bound, zero,
+                                             "epilogue.positive");
+        start = SelectInst::Create(positive, short_bound, zero, "epilogue.start", epilogue_preheader->getTerminator());
+    }
+    PHINode *epilogue_index = cast<PHINode>(VMap[longer->getCanonicalInductionVariable()]);
+    epilogue_index->setIncomingValueForBlock(epilogue_preheader, start);
+
+    condition->setOperand(1, short_bound);
+
+    outs() << "Extra iterations of loop " << longer->getName() << " peeled\n";
 }
 
 
@@ -165,8 +531,8 @@ bool isDistanceNegative (Instruction *inst1, Instruction *inst2, Loop *loop1, Lo
     // Recover the base address of the two arrays, since they need to be the same
     if (SE.getPointerBase(inst1_add_rec) != SE.getPointerBase(inst2_add_rec)) {
         outs() << "can't analyze SCEV with different pointer base\n";
-        // in this case there are no negative distance dependences between the instructions
-        return false;
+        // the dependence analysis found that the bases may alias, the distance is unknown
+        return true;
     }
 
     const SCEV* start_first_inst = inst1_add_rec->getStart();
@@ -254,142 +620,438 @@ bool isDistanceNegative (Instruction *inst1, Instruction *inst2, Loop *loop1, Lo
 }
 
 
+/** @brief Returns true if an access of a loop nest may depend on an access of a following nest with a negative
+ * distance at the outermost level, i.e. if the second nest may access an element in an earlier iteration of its
+ * outer loop than the one in which the first nest accesses it.
+ * The address of each access is decomposed into a start invariant in the nest and an affine term for each loop of
+ * the nest it evolves in. The outer loops must have the same stride, the inner loops (which are not fused at this
+ * level) contribute a range of offsets bounded by their trip counts: the distance is non-negative if, for every
+ * offset in the ranges, the difference of the addresses is greater than minus the outer stride.
+ * 
+ * @param inst1 access of the first nest
+ * @param inst2 access of the second nest
+ * @param loop1 outer loop of the first nest
+ * @param loop2 outer loop of the second nest
+ * @param SE the scalar evolution
+ * @return true if the distance may be negative
+*/
+bool isOuterDistanceNegative (Instruction *inst1, Instruction *inst2, Loop *loop1, Loop *loop2, ScalarEvolution &SE)
+{
+    struct NestAccess
+    {
+        const SCEV *start = nullptr, *outer_stride = nullptr, *min_offset = nullptr, *max_offset = nullptr;
+    };
+
+    // split the address into its start, the stride of the outer loop and the offsets of the inner loops
+    auto decompose = [&SE] (Instruction *inst, Loop *outer, NestAccess &access) -> bool {
+        const SCEV *address = SE.getSCEV(getLoadStorePointerOperand(inst));
+        Type *offset_type = SE.getEffectiveSCEVType(address->getType());
+        access.min_offset = access.max_offset = SE.getZero(offset_type);
+
+        while (const SCEVAddRecExpr *recurrence = dyn_cast<SCEVAddRecExpr>(address))
+        {
+            const Loop *level = recurrence->getLoop();
+            const SCEV *step = recurrence->getStepRecurrence(SE);
+            if (!outer->contains(level) || !recurrence->isAffine() || !SE.isLoopInvariant(step, outer))
+                return false;
+            address = recurrence->getStart();
+
+            if (level == outer)
+            {
+                access.outer_stride = step;
+                continue;
+            }
+
+            const SCEV *backedges = SE.getBackedgeTakenCount(level);
+            if (isa<SCEVCouldNotCompute>(backedges) || !level->contains(inst) || !SE.isLoopInvariant(backedges, outer))
+                return false;
+            // the blocks after a header which exits the loop are executed once less than it
+            if (level->getExitingBlock() == level->getHeader() && inst->getParent() != level->getHeader())
+                backedges = SE.getMinusSCEV(backedges, SE.getOne(backedges->getType()));
+            const SCEV *span = SE.getMulExpr(step, SE.getNoopOrZeroExtend(backedges, offset_type));
+            if (SE.isKnownPositive(step))
+                access.max_offset = SE.getAddExpr(access.max_offset, span);
+            else if (SE.isKnownNegative(step))
+                access.min_offset = SE.getAddExpr(access.min_offset, span);
+            else
+                return false;
+        }
+        access.start = address;
+        return access.outer_stride && SE.isLoopInvariant(address, outer);
+    };
+
+    NestAccess access1, access2;
+    if (!decompose(inst1, loop1, access1) || !decompose(inst2, loop2, access2))
+    {
+        outs() << "Can't decompose the address of an access in the nest\n";
+        return true;
+    }
+
+    // the bases may alias, as for the accesses of innermost loops (see isDistanceNegative)
+    if (SE.getPointerBase(access1.start) != SE.getPointerBase(access2.start))
+        return true;
+
+    const SCEV *stride = access1.outer_stride;
+    if (stride != access2.outer_stride || access1.min_offset->getType() != access2.min_offset->getType())
+    {
+        outs() << "Cannot compute distance\n";
+        return true;
+    }
+
+    // stride * distance lies in [delta + min1 - max2, delta + max1 - min2]
+    const SCEV *delta = SE.getMinusSCEV(access1.start, access2.start);
+    if (isa<SCEVCouldNotCompute>(delta))
+        return true;
+    const SCEV *low = SE.getMinusSCEV(SE.getAddExpr(delta, access1.min_offset), access2.max_offset);
+    const SCEV *high = SE.getMinusSCEV(SE.getAddExpr(delta, access1.max_offset), access2.min_offset);
+
+    #ifdef DEBUG
+        outs() << "Outer stride: " << *stride << ", stride * distance in [" << *low << ", " << *high << "]\n";
+    #endif
+
+    // the distance is greater than -1
+    if (SE.isKnownPositive(stride))
+        return !SE.isKnownPositive(SE.getAddExpr(low, stride));
+    if (SE.isKnownNegative(stride))
+        return !SE.isKnownPositive(SE.getMinusSCEV(SE.getNegativeSCEV(high), stride));
+    return true;
+}
+
+
+/**
+ * Loads and stores of a loop grouped by the object they access (see collectAccessBuckets).
+*/
+typedef MapVector<const Value*, SmallVector<Instruction*, 8>> AccessBuckets;
+
+/** @brief Group the loads and stores of a loop by their underlying object.
+ * 
+ * @param l loop
+ * @param buckets filled with the accesses to each object
+*/
+void collectAccessBuckets (Loop *l, AccessBuckets &buckets)
+{
+    for (BasicBlock *BB : l->blocks())
+        for (Instruction &inst : *BB)
+            if (isa<LoadInst>(inst) || isa<StoreInst>(inst))
+                buckets[getUnderlyingObject(getLoadStorePointerOperand(&inst))].push_back(&inst);
+}
+
+
 /**
  * Checks if two loops contain any negative distance dependencies
  * 
+ * The dependences checked are the ones between a store of a loop and a load or a store of the other loop. The
+ * accesses are grouped by their underlying object, and only the groups of objects which may alias are compared, so
+ * that the dependence analysis is not queried for accesses to different arrays. A dependence between accesses with
+ * different pointer bases, which may alias, has an unknown distance and prevents the fusion. The result of a query
+ * is memoized for the pair of addresses, since the accesses of unrolled loops often share the same address
+ * expression.
+ * The accesses in the subloops of loop nests are checked with the distance of the outer loops (see
+ * isOuterDistanceNegative), the subloops are fused later as siblings in the fused loop.
+ * 
  * @param loop1 the first loop
  * @param loop2 the second loop
  * @param SE the scalar evolution
  * @param DI the dependency info
  * @param LI the loop info
+ * @param AA the alias analysis
  * @return true if there are negative distance dependencies, false otherwise
  */
-bool areDistanceIndependent (Loop *loop1, Loop *loop2, ScalarEvolution &SE, DependenceInfo &DI, LoopInfo &LI)
+bool areDistanceIndependent (Loop *loop1, Loop *loop2, ScalarEvolution &SE, DependenceInfo &DI, LoopInfo &LI,
+                             AAResults &AA)
 {
-    // get all the loads and stores
-    std::vector<Instruction*> loads_first_loop, stores_first_loop, loads_second_loop, stores_second_loop;
-
-    // lambda to collect loads and stores in vectors 
-    auto collectLoadStores = [] (std::vector<Instruction*> *loads, std::vector<Instruction*> *stores, Loop *l) {
-        for (auto BI = l->block_begin(); BI != l->block_end(); ++BI) {
-            
-            BasicBlock *BB = *BI;
-
-            for (auto i = BB->begin(); i != BB->end(); i++) {
-                Instruction *inst = dyn_cast<Instruction>(i);
-
-                if (inst){
-                    if (isa<StoreInst>(inst))
-                        stores->push_back(inst);
-                    if (isa<LoadInst>(inst))
-                        loads->push_back(inst);
-                }
-                else
-                    continue;
-
-            }}
-    };
-    
-    collectLoadStores(&loads_first_loop, &stores_first_loop, loop1);
-    collectLoadStores(&loads_second_loop, &stores_second_loop, loop2);
+    AccessBuckets buckets_first_loop, buckets_second_loop;
+    collectAccessBuckets(loop1, buckets_first_loop);
+    collectAccessBuckets(loop2, buckets_second_loop);
 
-    #ifdef DEBUG        
-        outs() << "\n Loads first loop dump \n";
-        for(auto i : loads_first_loop)   
-            outs() << *i << "\n";
-
-        outs() << "\n Loads second loop dump \n";
-        for(auto i : loads_second_loop)   
-            outs() << *i << "\n";
-        
-        outs() << "\n Stores first loop dump \n";    
-        for(auto i : stores_first_loop)  
-            outs() << *i << "\n";
-        
-        outs() << "\n Stores second loop dump \n";  
-        for(auto i : stores_second_loop)  
-            outs() << *i << "\n";
+    #ifdef DEBUG
+        outs() << "Objects accessed by the first loop: " << buckets_first_loop.size() << ", by the second loop: "
+               << buckets_second_loop.size() << "\n";
     #endif
-    
-    for (auto store: stores_first_loop)
-    {        
-        for (auto load: loads_second_loop)
-        {
-            auto instruction_dependence = DI.depends(store, load, true);
 
-            #ifdef DEBUG
-                outs() << "Checking " << *load << " " << *store << " dep? " << (instruction_dependence ? "True" : "False") << "\n";
-            #endif
+    // an access is identified by its address and by the accessed type
+    typedef std::pair<const SCEV*, Type*> Access;
+    auto getAccess = [&SE] (Instruction *inst) -> Access {
+        return {SE.getSCEV(getLoadStorePointerOperand(inst)), getLoadStoreType(inst)};
+    };
+    enum DependenceKind { Independent, NonNegative, Negative };
+    DenseMap<std::pair<Access, Access>, DependenceKind> memo;
 
-            if (!instruction_dependence)
+    for (auto &bucket1 : buckets_first_loop)
+    {
+        for (auto &bucket2 : buckets_second_loop)
+        {
+            if (bucket1.first != bucket2.first && AA.isNoAlias(MemoryLocation::getBeforeOrAfter(bucket1.first),
+                                                               MemoryLocation::getBeforeOrAfter(bucket2.first)))
                 continue;
 
-            // check that load and store inst are not part of a nested loop
-            if(LI.getLoopFor(load->getParent()) != loop2 || LI.getLoopFor(store->getParent()) != loop1)
+            for (Instruction *inst1 : bucket1.second)
             {
-                outs() << "One of the instructions is in a nested loop, can't perform fusion\n";
-                return false;
+                for (Instruction *inst2 : bucket2.second)
+                {
+                    if (isa<LoadInst>(inst1) && isa<LoadInst>(inst2))
+                        continue;
+
+                    // the accesses in the subloops of a nest are checked at the level of the outer loops
+                    bool nested = LI.getLoopFor(inst1->getParent()) != loop1 ||
+                                  LI.getLoopFor(inst2->getParent()) != loop2;
+                    auto [it, inserted] = memo.try_emplace({getAccess(inst1), getAccess(inst2)}, Independent);
+                    if (inserted && DI.depends(inst1, inst2, true))
+                    {
+                        bool negative = nested ? isOuterDistanceNegative(inst1, inst2, loop1, loop2, SE)
+                                               : isDistanceNegative(inst1, inst2, loop1, loop2, SE);
+                        it->second = negative ? Negative : NonNegative;
+                    }
+
+                    #ifdef DEBUG
+                        outs() << "Checking " << *inst1 << " " << *inst2 << " dep? " << it->second << "\n";
+                    #endif
+
+                    if (it->second == Negative)
+                        return false;
+                }
             }
+        }
+    }
 
-            // If isDistanceNegative, then there is a negative distance dependency, so return false
-            if (isDistanceNegative(store, load, loop1, loop2, SE))
-                return false;
+    return true;
+}
+
+
+/** @brief Returns true if the structure of the loops allows to fuse them.
+ * Both the loops must exit from the header, and have a canonical induction variable of the same type and a latch
+ * reached only from the body. The header and the latch of the second loop are deleted by the fusion, hence they
+ * must only contain the induction variable, its increment, the exit condition and the branches.
+ *
+ * @param l1 loop 1
+ * @param l2 loop 2
+ * @return bool
+*/
+bool haveFusibleStructure (Loop *l1, Loop *l2)
+{
+    for (Loop *l : {l1, l2})
+    {
+        BasicBlock *latch = l->getLoopLatch();
+        if (!latch || !latch->getUniquePredecessor() || latch->getUniquePredecessor() == l->getHeader()
+            || l->getExitingBlock() != l->getHeader() || !l->getExitBlock())
+        {
+            outs() << "Loop " << l->getName() << " is not in the form header, body, latch\n";
+            return false;
         }
     }
 
-    for (auto store: stores_second_loop)
-    {        
-        for (auto load: loads_first_loop)
+    PHINode *index1 = l1->getCanonicalInductionVariable();
+    PHINode *index2 = l2->getCanonicalInductionVariable();
+    if (!index1 || !index2 || index1->getType() != index2->getType())
+    {
+        outs() << "Induction variables are not canonical\n";
+        return false;
+    }
+
+    BranchInst *l2_branch = dyn_cast<BranchInst>(l2->getHeader()->getTerminator());
+    if (!l2_branch || !l2_branch->isConditional())
+        return false;
+    Value *l2_increment = index2->getIncomingValueForBlock(l2->getLoopLatch());
+    for (Instruction &inst : *l2->getHeader())
+    {
+        if (&inst != index2 && &inst != l2_branch && (&inst != l2_branch->getCondition() || !inst.hasOneUse()))
         {
-            auto instruction_dependence = DI.depends(store, load, true);
+            outs() << "Header of the second loop is not empty\n";
+            return false;
+        }
+    }
+    for (Instruction &inst : *l2->getLoopLatch())
+    {
+        if (&inst != l2_increment && !inst.isTerminator())
+        {
+            outs() << "Latch of the second loop is not empty\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Memory streams of a loop, i.e. the accesses with the same pointer base and the same stride, mapped to the cache
+ * lines they load in each iteration. The streams of the two loops are matched by their key, so that a stream read
+ * by both the loops is counted once after the fusion.
+*/
+typedef DenseMap<std::pair<const SCEV*, const SCEV*>, double> StreamMap;
 
-            #ifdef DEBUG
-                outs() << "Checking " << *load << " " << *store << " dep? " << (instruction_dependence ? "True" : "False") << "\n";
-            #endif
+/** @brief Collect the memory streams of a loop.
+ * An access with a constant stride loads a new cache line every line size / stride iterations, an access to a
+ * loop invariant address stays in the cache, and any other access is assumed to load a line in each iteration.
+ * In a loop nest the stride is the one of the innermost loop the address evolves in, and the lines are counted for
+ * each iteration of that loop, while the footprint grows with the trip count of every loop of the evolution.
+ * 
+ * @param l loop
+ * @param SE scalar evolution
+ * @param line_size size of a cache line
+ * @param streams filled with the streams of the loop
+ * @return the bytes accessed by the loop, or UINT64_MAX if the number of iterations is unknown
+*/
+uint64_t getMemoryStreams (Loop *l, ScalarEvolution &SE, unsigned line_size, StreamMap &streams)
+{
+    unsigned trip_count = SE.getSmallConstantTripCount(l);
+    uint64_t footprint = 0;
 
-            if (!instruction_dependence) 
+    for (BasicBlock *BB : l->blocks())
+    {
+        for (Instruction &inst : *BB)
+        {
+            Value *pointer = getLoadStorePointerOperand(&inst);
+            if (!pointer)
                 continue;
 
-            // check that load and store inst are not part of a nested loop
-            if(LI.getLoopFor(load->getParent()) != loop1 || LI.getLoopFor(store->getParent()) != loop2)
+            const SCEV *access = SE.getSCEV(pointer);
+            const SCEV *base = SE.getPointerBase(access);
+            const SCEV *stride = nullptr;
+            double lines = 1;
+            uint64_t bytes = line_size;
+            uint64_t iterations = trip_count;
+
+            const SCEVAddRecExpr *recurrence = dyn_cast<SCEVAddRecExpr>(access);
+            if (recurrence && l->contains(recurrence->getLoop()) &&
+                isa<SCEVConstant>(recurrence->getStepRecurrence(SE)))
             {
-                outs() << "One of the instructions is in a nested loop, can't perform fusion\n";
-                return false;
+                stride = recurrence->getStepRecurrence(SE);
+                bytes = cast<SCEVConstant>(stride)->getAPInt().abs().getLimitedValue(line_size);
+                lines = (double) bytes / line_size;
+
+                iterations = 1;
+                const SCEVAddRecExpr *level = recurrence;
+                for (; level; level = dyn_cast<SCEVAddRecExpr>(level->getStart()))
+                    if (l->contains(level->getLoop()))
+                        iterations *= SE.getSmallConstantTripCount(level->getLoop());
+            }
+            else if (SE.isLoopInvariant(access, l))
+            {
+                stride = SE.getZero(access->getType());
+                lines = bytes = 0;
             }
 
-            // If isDistanceNegative, then there is a negative distance dependency, so return false
-            if (isDistanceNegative(load, store, loop1, loop2, SE))
-                return false;
+            auto [it, inserted] = streams.try_emplace({base, stride}, lines);
+            if (!inserted)
+                continue;
+            if (!trip_count || !iterations)
+                footprint = UINT64_MAX;
+            else if (footprint != UINT64_MAX)
+                footprint += bytes * iterations;
         }
     }
+    return footprint;
+}
 
-    return true;
+
+/** @brief Get the number of values live in every iteration of a loop.
+ * The values are the phis of the header and the values defined outside the loop (not constants) used inside it;
+ * the values defined and used in the same iteration are not counted.
+ * 
+ * @param l loop
+ * @param live filled with the values defined outside the loop
+ * @return the number of phis of the header
+*/
+unsigned getLiveValues (Loop *l, SmallPtrSetImpl<Value*> &live)
+{
+    for (BasicBlock *BB : l->blocks())
+        for (Instruction &inst : *BB)
+            for (Value *operand : inst.operands())
+                if ((isa<Instruction>(operand) && !l->contains(cast<Instruction>(operand))) || isa<Argument>(operand))
+                    live.insert(operand);
+
+    auto phis = l->getHeader()->phis();
+    return std::distance(phis.begin(), phis.end());
+}
+
+
+/** @brief Returns true if the fusion of two loops is profitable.
+ * The cache misses of each iteration are estimated from the memory streams of the loops (see getMemoryStreams):
+ * without the fusion, a stream of the second loop also read by the first one is still in the cache only if the
+ * first loop accesses less bytes than the size of the cache, while after the fusion it is loaded once. The fusion
+ * is profitable if it saves at least the percentage of misses given by -loopfusion-min-saved-misses, and if the
+ * values live in the fused loop fit in the registers when the ones of the separate loops do.
+ * The decision is reported for every candidate pair.
+ * 
+ * @param l1 loop 1
+ * @param l2 loop 2
+ * @param SE scalar evolution
+ * @param TTI target transform info
+ * @return bool
+*/
+bool isFusionProfitable (Loop *l1, Loop *l2, ScalarEvolution &SE, TargetTransformInfo &TTI)
+{
+    unsigned line_size = TTI.getCacheLineSize() ? TTI.getCacheLineSize() : 64;
+    uint64_t cache_size = LoopFusionCacheSize;
+    if (auto size = TTI.getCacheSize(TargetTransformInfo::CacheLevel::L1D))
+        cache_size = *size;
+
+    StreamMap streams1, streams2;
+    uint64_t footprint1 = getMemoryStreams(l1, SE, line_size, streams1);
+    getMemoryStreams(l2, SE, line_size, streams2);
+
+    double misses = 0, fused_misses = 0;
+    for (auto &stream : streams1)
+        misses += stream.second;
+    fused_misses = misses;
+    for (auto &stream : streams2)
+    {
+        bool shared = streams1.count(stream.first);
+        if (!shared || footprint1 > cache_size)
+            misses += stream.second;
+        if (!shared)
+            fused_misses += stream.second;
+    }
+
+    SmallPtrSet<Value*, 16> live1, live2;
+    unsigned phis1 = getLiveValues(l1, live1);
+    unsigned phis2 = getLiveValues(l2, live2);
+    unsigned registers = TTI.getNumberOfRegisters(TTI.getRegisterClassForType(false));
+    unsigned live_values1 = live1.size() + phis1;
+    unsigned live_values2 = live2.size() + phis2;
+    live1.insert(live2.begin(), live2.end());
+    // the induction variable of the second loop is replaced by the one of the first loop
+    unsigned fused_live_values = live1.size() + phis1 + phis2 - 1;
+
+    bool fewer_misses = fused_misses < misses && (misses - fused_misses) * 100 >= misses * LoopFusionMinSavedMisses;
+    bool spills = fused_live_values > registers && live_values1 <= registers && live_values2 <= registers;
+
+    outs() << "Fusion of " << l1->getName() << " and " << l2->getName() << ": " << format("%.2f", misses)
+           << " -> " << format("%.2f", fused_misses) << " cache lines per iteration, " << fused_live_values
+           << " live values (" << registers << " registers), "
+           << (fewer_misses && !spills ? "profitable" : "not profitable") << "\n";
+
+    return fewer_misses && !spills;
 }
 
 
 /** @brief Fuses the given loops.
- * The body of the second loop, after beeing unlinked, is connected after the body of the first loop.
+ * The body of the second loop, after beeing unlinked, is connected after the body of the first loop, and its
+ * preheader, header and latch are deleted.
+ * The analyses are updated with the changes, so that they are still valid for the next fusions: the dominator
+ * trees through the DomTreeUpdater, the blocks and the subloops of the second loop are moved to the first one,
+ * and scalar evolution forgets both the loops.
  * 
  * @param l1 loop 1
  * @param l2 loop 2
+ * @param LI loop info
+ * @param SE scalar evolution
+ * @param DTU dominator trees updater
 */
-void fuseLoop (Loop *l1, Loop *l2)
+void fuseLoop (Loop *l1, Loop *l2, LoopInfo &LI, ScalarEvolution &SE, DomTreeUpdater &DTU)
 {
-    BasicBlock *l2_entry_block = l2->isGuarded() ? l2->getLoopGuardBranch()->getParent() : l2->getLoopPreheader(); 
+    BasicBlock *l2_entry_block = l2->getLoopPreheader();
+    BasicBlock *l2_exit_block = l2->getExitBlock();
+
+    SE.forgetLoop(l2);
+    SE.forgetLoop(l1);
 
-    SmallVector<BasicBlock *> exits_blocks;
-    
     /*
     Replace the uses of the induction variable of the second loop with 
     the induction variable of the first loop.
     */
     PHINode *index1 = l1->getCanonicalInductionVariable();
     PHINode *index2 = l2->getCanonicalInductionVariable();
-    if (!index1 || !index2)
-    {
-        outs() << "Induction variables are not canonical\n";
-        return;
-    }
     index2->replaceAllUsesWith(index1);
 
     /*
@@ -419,29 +1081,57 @@ void fuseLoop (Loop *l1, Loop *l2)
         }
     };
     
-    LoopStructure *first_loop = new LoopStructure(l1);
-    LoopStructure *second_loop = new LoopStructure(l2);
-
-    l2->getExitBlocks(exits_blocks);
-    for (BasicBlock *BB : exits_blocks)
+    LoopStructure first_loop(l1);
+    LoopStructure second_loop(l2);
+
+    // the first loop exits where the second one did
+    first_loop.header->getTerminator()->replaceUsesOfWith(l2_entry_block, l2_exit_block);
+    l2_exit_block->replacePhiUsesWith(second_loop.header, first_loop.header);
+
+    // the header of the second loop is left without successors, it is deleted below
+    second_loop.header->getTerminator()->eraseFromParent();
+    new UnreachableInst(second_loop.header->getContext(), second_loop.header);
+
+    first_loop.body_tail->getTerminator()->replaceUsesOfWith(first_loop.latch, second_loop.body_head);
+    second_loop.body_head->replacePhiUsesWith(second_loop.header, first_loop.body_tail);
+    second_loop.body_tail->getTerminator()->replaceUsesOfWith(second_loop.latch, first_loop.latch);
+    first_loop.latch->replacePhiUsesWith(first_loop.body_tail, second_loop.body_tail);
+
+    DTU.applyUpdates({{DominatorTree::Delete, first_loop.header, l2_entry_block},
+                      {DominatorTree::Insert, first_loop.header, l2_exit_block},
+                      {DominatorTree::Delete, second_loop.header, second_loop.body_head},
+                      {DominatorTree::Delete, second_loop.header, l2_exit_block},
+                      {DominatorTree::Delete, first_loop.body_tail, first_loop.latch},
+                      {DominatorTree::Insert, first_loop.body_tail, second_loop.body_head},
+                      {DominatorTree::Delete, second_loop.body_tail, second_loop.latch},
+                      {DominatorTree::Insert, second_loop.body_tail, first_loop.latch}});
+
+    // the remaining blocks and the subloops of the second loop are moved to the first one
+    SmallVector<BasicBlock*, 3> dead_blocks = {l2_entry_block, second_loop.header, second_loop.latch};
+    for (BasicBlock *BB : dead_blocks)
+        LI.removeBlock(BB);
+
+    SmallVector<BasicBlock*, 8> l2_blocks(l2->blocks());
+    for (BasicBlock *BB : l2_blocks)
     {
-        for (pred_iterator pit = pred_begin(BB); pit != pred_end(BB); pit++)
-        {
-            BasicBlock *predecessor = dyn_cast<BasicBlock>(*pit);
-            if (predecessor == l2->getHeader())
-            {
-                l1->getHeader()->getTerminator()->replaceUsesOfWith(l2_entry_block, BB);
-            }
-        }
+        l1->addBlockEntry(BB);
+        l2->removeBlockFromLoop(BB);
+        if (LI.getLoopFor(BB) == l2)
+            LI.changeLoopFor(BB, l1);
     }
+    while (!l2->isInnermost())
+    {
+        Loop *child = *l2->begin();
+        l2->removeChildLoop(l2->begin());
+        l1->addChildLoop(child);
+    }
+    LI.erase(l2);
 
-    BranchInst *new_branch = BranchInst::Create(second_loop->latch);
-    ReplaceInstWithInst(second_loop->header->getTerminator(), new_branch);
-
-    first_loop->body_tail->getTerminator()->replaceUsesOfWith(first_loop->latch, second_loop->body_head);
-    second_loop->body_tail->getTerminator()->replaceUsesOfWith(second_loop->latch, first_loop->latch);
+    DeleteDeadBlocks(dead_blocks, &DTU);
 
-    delete first_loop; delete second_loop;
+    // the bodies are joined in a single block, so that the exit of a subloop of the first loop is the preheader of
+    // the following subloop of the second one, which can be fused in turn
+    MergeBlockIntoPredecessor(second_loop.body_head, &DTU, &LI);
 
     outs() << "Fusion done\n";
     return;
@@ -455,6 +1145,9 @@ PreservedAnalyses LoopFusion::run (Function &F,FunctionAnalysisManager &AM)
     DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
     PostDominatorTree &PDT = AM.getResult<PostDominatorTreeAnalysis>(F);
     DependenceInfo &DI = AM.getResult<DependenceAnalysis>(F);
+    AAResults &AA = AM.getResult<AAManager>(F);
+    TargetTransformInfo &TTI = AM.getResult<TargetIRAnalysis>(F);
+    DomTreeUpdater DTU(&DT, &PDT, DomTreeUpdater::UpdateStrategy::Eager);
 
     SmallVector<Loop *, 4> loops_forest = LI.getLoopsInPreorder();
 
@@ -463,7 +1156,7 @@ PreservedAnalyses LoopFusion::run (Function &F,FunctionAnalysisManager &AM)
 
     std::unordered_map<unsigned, Loop*> last_loop_at_level = {{loops_forest[0]->getLoopDepth(), loops_forest[0]}};
 
-    bool fusion_happened = false;
+    unsigned fusions = 0;
 
     for (size_t i = 1; i < loops_forest.size(); i++)
     {
@@ -478,19 +1171,414 @@ PreservedAnalyses LoopFusion::run (Function &F,FunctionAnalysisManager &AM)
             Expoliting the logical short-circuit, as soon as one of the functions returns false, 
             the others remaining checks are not executed and the if statement condition becomes false.
             */ 
-            if (areAdjacent(l1, l2) && 
-                haveSameIterationsNumber(l1, l2, &SE) && 
+            Value *short_bound = nullptr;
+            Loop *longer = nullptr;
+            SmallVector<Instruction*, 8> hoisted, sunk;
+            if (areAdjacent(l1, l2, AA, DT, hoisted, sunk) && 
+                (haveSameIterationsNumber(l1, l2, &SE) || (longer = getLongerLoop(l1, l2, SE, DT, AA, hoisted, sunk, short_bound))) && 
                 areFlowEquivalent(l1, l2, &DT, &PDT) && 
-                areDistanceIndependent(l1, l2, SE, DI, LI))
+                areDistanceIndependent(l1, l2, SE, DI, LI, AA) &&
+                haveFusibleStructure(l1, l2) &&
+                isFusionProfitable(l1, l2, SE, TTI))
             {
                 outs() << "Starting fusion ...\n";
-                fuseLoop(l1, l2);
-                fusion_happened = true;
-                break;
+                moveInterveningCode(l1, l2, hoisted, sunk);
+                if (longer)
+                    peelExtraIterations(longer, l2, short_bound, LI, SE, DT, DTU);
+                fuseLoop(l1, l2, LI, SE, DTU);
+                fusions++;
+                // the fused loop is the candidate for the fusion with the next loop of the chain
+                continue;
             }
         }
         last_loop_at_level[loop_depth] = loops_forest[i];
     }
 
-    return fusion_happened ? PreservedAnalyses::none() : PreservedAnalyses::all();
-}
\ No newline at end of file
+    if (!fusions)
+        return PreservedAnalyses::all();
+
+    outs() << F.getName() << ": " << fusions << " fusions\n";
+
+    // the analyses are updated by each fusion
+    PreservedAnalyses PA;
+    PA.preserve<DominatorTreeAnalysis>();
+    PA.preserve<PostDominatorTreeAnalysis>();
+    PA.preserve<LoopAnalysis>();
+    PA.preserve<ScalarEvolutionAnalysis>();
+    return PA;
+}
+
+
+/** @brief Compute the strongly connected components of a graph (Tarjan).
+ * 
+ * @param graph the successors of each node
+ * @return the components, in reverse topological order
+*/
+std::vector<SmallVector<unsigned, 4>> getSCCs (const std::vector<SmallVector<unsigned, 4>> &graph)
+{
+    std::vector<SmallVector<unsigned, 4>> sccs;
+    std::vector<unsigned> index(graph.size(), 0), low(graph.size(), 0);
+    std::vector<bool> on_stack(graph.size(), false);
+    SmallVector<unsigned, 16> stack;
+    unsigned next_index = 1;
+
+    std::function<void(unsigned)> visit = [&] (unsigned node) {
+        index[node] = low[node] = next_index++;
+        stack.push_back(node);
+        on_stack[node] = true;
+
+        for (unsigned successor : graph[node])
+        {
+            if (!index[successor])
+            {
+                visit(successor);
+                low[node] = std::min(low[node], low[successor]);
+            }
+            else if (on_stack[successor])
+                low[node] = std::min(low[node], index[successor]);
+        }
+
+        if (low[node] != index[node])
+            return;
+        SmallVector<unsigned, 4> scc;
+        unsigned member;
+        do
+        {
+            member = stack.pop_back_val();
+            on_stack[member] = false;
+            scc.push_back(member);
+        } while (member != node);
+        sccs.push_back(scc);
+    };
+
+    for (unsigned node = 0; node < graph.size(); node++)
+        if (!index[node])
+            visit(node);
+    return sccs;
+}
+
+
+/** @brief Build the dependence graph of the body of a loop.
+ * An edge from an instruction to another one means that the first one must be executed before the second one: the
+ * definitions precede their uses, and the memory accesses which may depend on each other follow the order of their
+ * dependence, found as for the fusion (see isDistanceNegative). A dependence with a negative or unknown distance
+ * gets an edge in both directions, so that the accesses are kept in the same loop.
+ * 
+ * @param l loop
+ * @param body the instructions of the body
+ * @param SE scalar evolution
+ * @param DI dependence info
+ * @param graph filled with the successors of each instruction (indexes in body)
+ * @return false if the body contains instructions which can't be distributed
+*/
+bool buildDependenceGraph (Loop *l, ArrayRef<Instruction*> body, ScalarEvolution &SE, DependenceInfo &DI,
+                           std::vector<SmallVector<unsigned, 4>> &graph)
+{
+    DenseMap<Instruction*, unsigned> position;
+    for (unsigned i = 0; i < body.size(); i++)
+        position[body[i]] = i;
+
+    graph.assign(body.size(), {});
+    SmallVector<unsigned, 16> accesses;
+    for (unsigned i = 0; i < body.size(); i++)
+    {
+        Instruction *inst = body[i];
+        bool is_simple_access = (isa<LoadInst>(inst) && cast<LoadInst>(inst)->isSimple()) ||
+                                (isa<StoreInst>(inst) && cast<StoreInst>(inst)->isSimple());
+        if (isa<PHINode>(inst) || (inst->mayReadOrWriteMemory() ? !is_simple_access : inst->mayHaveSideEffects()))
+        {
+            outs() << "The body contains instructions which can't be distributed\n";
+            return false;
+        }
+        if (is_simple_access)
+            accesses.push_back(i);
+
+        for (User *user : inst->users())
+        {
+            auto it = position.find(cast<Instruction>(user));
+            if (it == position.end())
+            {
+                outs() << "Values of the body are used outside of it, can't distribute the loop\n";
+                return false;
+            }
+            graph[i].push_back(it->second);
+        }
+    }
+
+    for (unsigned i = 0; i < accesses.size(); i++)
+    {
+        for (unsigned j = i + 1; j < accesses.size(); j++)
+        {
+            Instruction *inst1 = body[accesses[i]];
+            Instruction *inst2 = body[accesses[j]];
+            if ((isa<LoadInst>(inst1) && isa<LoadInst>(inst2)) || !DI.depends(inst1, inst2, true))
+                continue;
+
+            graph[accesses[i]].push_back(accesses[j]);
+
+            const SCEV *base1 = SE.getPointerBase(SE.getSCEV(getLoadStorePointerOperand(inst1)));
+            const SCEV *base2 = SE.getPointerBase(SE.getSCEV(getLoadStorePointerOperand(inst2)));
+            if (base1 != base2 || isDistanceNegative(inst1, inst2, l, l, SE))
+                graph[accesses[j]].push_back(accesses[i]);
+        }
+    }
+    return true;
+}
+
+
+/** @brief Partition the body of a loop for the distribution.
+ * The partitions are formed by the strongly connected components of the dependence graph (see
+ * buildDependenceGraph) which contain a memory access or a cycle, i.e. a dependence carried by the loop. The other
+ * instructions only compute values, and are copied in every partition using them. Partitions are merged when a value
+ * of one of them is used by another one, or when the dependences between them form a cycle; the remaining
+ * partitions are ordered by their dependences, and the consecutive ones of the same kind (with or without a carried
+ * dependence) are merged, since splitting them would not let any of them vectorize.
+ * 
+ * @param body the instructions of the body
+ * @param graph the dependence graph of the body
+ * @param partitions filled with the partitions of each instruction, in the order of the distributed loops
+ * @return the number of partitions
+*/
+unsigned partitionBody (ArrayRef<Instruction*> body, const std::vector<SmallVector<unsigned, 4>> &graph,
+                        std::vector<SmallVector<unsigned, 2>> &partitions)
+{
+    std::vector<SmallVector<unsigned, 4>> sccs = getSCCs(graph);
+    std::vector<unsigned> scc_of(body.size());
+    for (unsigned scc = 0; scc < sccs.size(); scc++)
+        for (unsigned node : sccs[scc])
+            scc_of[node] = scc;
+
+    std::vector<bool> is_seed(sccs.size()), is_carried(sccs.size());
+    for (unsigned scc = 0; scc < sccs.size(); scc++)
+    {
+        is_carried[scc] = sccs[scc].size() > 1;
+        is_seed[scc] = is_carried[scc] || body[sccs[scc].front()]->mayReadOrWriteMemory();
+    }
+
+    // partitions are identified by one of their components
+    std::vector<unsigned> leader(sccs.size());
+    std::iota(leader.begin(), leader.end(), 0);
+    std::function<unsigned(unsigned)> find = [&] (unsigned scc) {
+        return leader[scc] == scc ? scc : leader[scc] = find(leader[scc]);
+    };
+    auto merge = [&] (unsigned scc1, unsigned scc2) {
+        scc1 = find(scc1);
+        scc2 = find(scc2);
+        if (scc1 == scc2)
+            return false;
+        leader[scc2] = scc1;
+        return true;
+    };
+
+    std::vector<unsigned> order;
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+
+        // the components are in reverse topological order, the users of a value are visited before it
+        partitions.assign(body.size(), {});
+        for (unsigned scc = 0; scc < sccs.size(); scc++)
+        {
+            for (unsigned node : sccs[scc])
+            {
+                if (is_seed[scc])
+                {
+                    partitions[node].push_back(find(scc));
+                    continue;
+                }
+                for (unsigned user : graph[node])
+                    for (unsigned partition : partitions[user])
+                        if (!is_contained(partitions[node], partition))
+                            partitions[node].push_back(partition);
+            }
+        }
+
+        // the values of a partition can't be used by another one
+        for (unsigned node = 0; node < body.size(); node++)
+            if (is_seed[scc_of[node]])
+                for (unsigned user : graph[node])
+                    if (is_contained(body[node]->users(), body[user]))
+                        for (unsigned partition : partitions[user])
+                            merged |= merge(scc_of[node], partition);
+        if (merged)
+            continue;
+
+        // the partitions with cyclic dependences are merged (the values are now used in their own partition, the
+        // dependences between partitions are the ones between memory accesses)
+        std::vector<SmallVector<unsigned, 4>> partition_graph(sccs.size());
+        for (unsigned node = 0; node < body.size(); node++)
+            for (unsigned successor : graph[node])
+                if (is_seed[scc_of[node]] && is_seed[scc_of[successor]] && partitions[node] != partitions[successor])
+                    partition_graph[partitions[node].front()].push_back(partitions[successor].front());
+
+        order.clear();
+        for (SmallVector<unsigned, 4> &component : getSCCs(partition_graph))
+        {
+            // the components which only compute values are not partitions
+            if (!is_seed[component.front()] || find(component.front()) != component.front())
+                continue;
+            for (unsigned partition : component)
+                merged |= merge(component.front(), partition);
+            order.push_back(component.front());
+        }
+    }
+    std::reverse(order.begin(), order.end());
+
+    std::vector<bool> is_carried_partition(sccs.size(), false);
+    for (unsigned scc = 0; scc < sccs.size(); scc++)
+        if (is_carried[scc])
+            is_carried_partition[find(scc)] = true;
+
+    // the consecutive partitions of the same kind are merged, and numbered from 0 in their order
+    std::vector<unsigned> number(sccs.size());
+    unsigned count = 0;
+    for (unsigned i = 0; i < order.size(); i++)
+    {
+        if (i > 0 && is_carried_partition[order[i]] == is_carried_partition[order[i - 1]])
+            number[order[i]] = number[order[i - 1]];
+        else
+            number[order[i]] = count++;
+    }
+
+    for (SmallVector<unsigned, 2> &node_partitions : partitions)
+    {
+        SmallVector<unsigned, 2> numbered;
+        for (unsigned partition : node_partitions)
+            if (!is_contained(numbered, number[partition]))
+                numbered.push_back(number[partition]);
+        node_partitions = numbered;
+    }
+    return count;
+}
+
+
+/** @brief Distribute a loop over the partitions of its body (see partitionBody).
+ * The loop must have the form handled by the fusion (header, body, latch), with a single block as body; its values
+ * can't be used after it. A copy of the loop is created for each partition after the first one, placed after the
+ * previous copies, and each copy only keeps the instructions of its partition.
+ * 
+ * @param l loop
+ * @param SE scalar evolution
+ * @param DI dependence info
+ * @param LI loop info
+ * @param DT dominator tree
+ * @return the number of loops created
+*/
+unsigned distributeLoop (Loop *l, ScalarEvolution &SE, DependenceInfo &DI, LoopInfo &LI, DominatorTree &DT)
+{
+    if (!l->isInnermost() || l->getNumBlocks() != 3 || !l->getLoopPreheader() || !haveFusibleStructure(l, l))
+        return 0;
+
+    BasicBlock *header = l->getHeader();
+    BasicBlock *latch = l->getLoopLatch();
+    BasicBlock *body_block = latch->getUniquePredecessor();
+    BasicBlock *exit_block = l->getExitBlock();
+    if (exit_block->getSinglePredecessor() != header)
+        return 0;
+
+    for (BasicBlock *BB : {header, latch})
+    {
+        for (Instruction &inst : *BB)
+        {
+            for (User *user : inst.users())
+            {
+                if (!l->contains(cast<Instruction>(user)))
+                {
+                    outs() << "Values of loop " << l->getName() << " are used after it, can't distribute the loop\n";
+                    return 0;
+                }
+            }
+        }
+    }
+
+    SmallVector<Instruction*, 16> body;
+    for (Instruction &inst : *body_block)
+        if (!inst.isTerminator())
+            body.push_back(&inst);
+
+    std::vector<SmallVector<unsigned, 4>> graph;
+    if (!buildDependenceGraph(l, body, SE, DI, graph))
+        return 0;
+
+    std::vector<SmallVector<unsigned, 2>> partitions;
+    unsigned count = partitionBody(body, graph, partitions);
+    if (count < 2)
+    {
+        outs() << "Distribution of loop " << l->getName() << " is not profitable\n";
+        return 0;
+    }
+
+    SE.forgetLoop(l);
+    DomTreeUpdater DTU(&DT, DomTreeUpdater::UpdateStrategy::Eager);
+
+    // the preheader is copied with each loop, it must be empty (see peelExtraIterations)
+    BasicBlock *preheader = l->getLoopPreheader();
+    if (preheader->size() > 1)
+        SplitBlock(preheader, preheader->getTerminator(), &DTU, &LI);
+
+    // the copies are placed before the exit block, the original loop keeps the first partition
+    std::vector<std::unique_ptr<ValueToValueMapTy>> copies;
+    BasicBlock *last_header = header;
+    for (unsigned partition = 1; partition < count; partition++)
+    {
+        copies.push_back(std::make_unique<ValueToValueMapTy>());
+        BasicBlock *current_exit_block = l->getExitBlock();
+        SmallVector<BasicBlock*, 8> copy_blocks;
+        Loop *copy = cloneLoopWithPreheader(exit_block, last_header, l, *copies.back(), ".dist" + Twine(partition),
+                                            &LI, &DT, copy_blocks);
+        remapInstructionsInBlocks(copy_blocks, *copies.back());
+
+        // the original loop already exits to the first copy
+        BasicBlock *copy_preheader = copy->getLoopPreheader();
+        copy->getHeader()->getTerminator()->replaceUsesOfWith(current_exit_block, exit_block);
+        last_header->getTerminator()->replaceUsesOfWith(exit_block, copy_preheader);
+        DTU.applyUpdates({{DominatorTree::Delete, last_header, exit_block},
+                          {DominatorTree::Insert, last_header, copy_preheader},
+                          {DominatorTree::Insert, copy->getHeader(), exit_block}});
+        last_header = copy->getHeader();
+    }
+    // the exit block is now reached from the last copy
+    exit_block->replacePhiUsesWith(header, last_header);
+
+    // the original loop is pruned last, since the copies are looked up through its instructions
+    for (unsigned partition = count; partition-- > 0;)
+    {
+        for (unsigned node = body.size(); node-- > 0;)
+        {
+            if (is_contained(partitions[node], partition))
+                continue;
+            Value *inst = partition > 0 ? (*copies[partition - 1])[body[node]] : body[node];
+            cast<Instruction>(inst)->eraseFromParent();
+        }
+    }
+
+    outs() << "Loop " << l->getName() << " distributed in " << count << " loops\n";
+    return count - 1;
+}
+
+
+PreservedAnalyses LoopDistribution::run (Function &F, FunctionAnalysisManager &AM)
+{
+    LoopInfo &LI = AM.getResult<LoopAnalysis>(F);
+    ScalarEvolution &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
+    DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
+    DependenceInfo &DI = AM.getResult<DependenceAnalysis>(F);
+
+    // the loops created by the distribution are not visited
+    SmallVector<Loop *, 4> loops = LI.getLoopsInPreorder();
+
+    unsigned created = 0;
+    for (Loop *l : loops)
+        created += distributeLoop(l, SE, DI, LI, DT);
+
+    if (!created)
+        return PreservedAnalyses::all();
+
+    outs() << F.getName() << ": " << created << " loops created by the distribution\n";
+
+    PreservedAnalyses PA;
+    PA.preserve<DominatorTreeAnalysis>();
+    PA.preserve<LoopAnalysis>();
+    return PA;
+}
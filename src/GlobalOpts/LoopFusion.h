@@ -9,5 +9,13 @@ namespace llvm
     public:
         PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
     };
+
+    /**
+     * Loop distribution, the inverse of the fusion, see README.md.
+    */
+    class LoopDistribution : public PassInfoMixin<LoopDistribution> {
+    public:
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+    };
 } // namespace llvm
 #endif // LLVM_TRANSFORMS_LOOPFUSION_H
\ No newline at end of file
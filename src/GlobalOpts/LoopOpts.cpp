@@ -1,45 +1,101 @@
 #include "llvm/Transforms/Utils/LoopOpts.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopAccessAnalysis.h"
+#include "llvm/Analysis/MemorySSAUpdater.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/LoopVersioning.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include <optional>
 
 #define DEBUG
 
 using namespace llvm;
 
-const std::string invariant_tag = "invariant";
-const std::string use_dominator = "use_dominator";
-const std::string exits_dominator = "exits_dominator";
-const std::string dead_tag = "dead";
+static cl::opt<unsigned> LoopOptsMaxRuntimeChecks("loopopts-max-runtime-checks", cl::init(8),
+    cl::desc("Maximum number of runtime alias checks of a loop versioned for code motion (0 = never version)"));
 
-/** @brief Remove all the previously applied metadatas.
+/**
+ * Memory accesses of a loop: the instructions which may write to memory, and whether an instruction may not
+ * transfer the execution to the next one (e.g. a call which throws or does not return).
+*/
+struct LoopMemory
+{
+    SmallVector<Instruction*> writes;
+    bool may_throw = false;
+};
+
+/**
+ * Results of the analysis of a loop, kept aside of the IR for a single run of the pass:
+ * the IR is only changed when an instruction is moved.
+*/
+struct LICMTable
+{
+    SmallPtrSet<Instruction*, 32> invariant;
+    SmallPtrSet<Instruction*, 32> use_dominator;
+    SmallPtrSet<Instruction*, 32> dead;
+    SmallPtrSet<BasicBlock*, 16> exits_dominator;
+    // memory accesses of the loop and of its parent loops, computed when needed
+    DenseMap<const Loop*, LoopMemory> memory;
+    // uses of the instructions through the phis (see getUses), computed when needed
+    DenseMap<Instruction*, std::vector<Use*>> uses;
+};
+
+/** @brief Get the memory accesses of a loop.
  * 
- * @param inst instruction
+ * @param L loop
+ * @param table analysis results of the loop
 */
-void clearMetadata (Instruction *inst) 
+const LoopMemory &getLoopMemory (Loop *L, LICMTable &table)
 {
-    SmallVector<std::string> tags = {invariant_tag, use_dominator, exits_dominator, dead_tag};
-    for (auto type: tags)
-        inst->setMetadata(type, NULL);
+    auto [entry, is_new] = table.memory.try_emplace(L);
+    if (!is_new)
+        return entry->second;
+
+    for (BasicBlock *BB : L->blocks())
+    {
+        for (Instruction &I : *BB)
+        {
+            if (I.mayWriteToMemory())
+                entry->second.writes.push_back(&I);
+            if (!isGuaranteedToTransferExecutionToSuccessor(&I))
+                entry->second.may_throw = true;
+        }
+    }
+    return entry->second;
 }
 
-/** @brief Apply a specified metadata to an instruction.
+/** @brief Check if an instruction of the loop may write the memory read by a load.
  * 
- * @param inst instruction
- * @param tag tag to apply
+ * @param load load
+ * @param memory memory accesses of the loop
+ * @param AA alias analysis
 */
-void applyMetadata (Instruction *inst, const std::string tag)
+bool mayBeClobbered (LoadInst *load, const LoopMemory &memory, AAResults *AA)
 {
-    LLVMContext &C = inst->getContext();
-    MDNode *N = MDNode::get(C, MDString::get(C, ""));
-    inst->setMetadata(tag, N);
+    MemoryLocation location = MemoryLocation::get(load);
+    for (Instruction *write : memory.writes)
+    {
+        if (isModSet(AA->getModRefInfo(write, location)))
+            return true;
+    }
+    return false;
 }
 
 /** @brief Check if instruction is already marked as Invariant.
  * 
  * @param inst checked instruction
+ * @param table analysis results of the loop
 */
-bool isAlreadyLoopInvariant (Instruction *inst)
+bool isAlreadyLoopInvariant (Instruction *inst, const LICMTable &table)
 {
-    return inst->getMetadata(invariant_tag);
+    return table.invariant.count(inst);
 }
 
 /** @brief Check if the Value is LoopInvariant.
@@ -53,13 +109,14 @@ bool isAlreadyLoopInvariant (Instruction *inst)
  * 
  * @param v value
  * @param L loop
+ * @param table analysis results of the loop
 */ 
-bool isLoopInvariant (Value *v, Loop* L)
+bool isLoopInvariant (Value *v, Loop* L, const LICMTable &table)
 {
     //NULL when v is an argument of the function
     Instruction *v_inst = dyn_cast<Instruction>(v); 
     
-    if (!v_inst || isAlreadyLoopInvariant(v_inst) || !L->contains(v_inst))
+    if (!v_inst || isAlreadyLoopInvariant(v_inst, table) || !L->contains(v_inst))
         return true;
     
     #ifdef DEBUG
@@ -80,24 +137,63 @@ bool isLoopInvariant (Value *v, Loop* L)
     return false;
 }
 
-/** @brief Mark with a metadata an Instruction if it is LoopInvariant. 
+/** @brief Check if an instruction can be moved out of a loop.
+ * Any instruction without side effects can be moved (e.g. arithmetic, getelementptr, casts, comparisons, selects
+ * and calls to readnone intrinsics), as well as the loads; phis, allocas, and instructions which cannot be
+ * duplicated or moved across control flow (tokens, convergent calls) are not candidates.
+ * 
+ * @param inst instruction
+*/
+bool isCandidate (Instruction *inst)
+{
+    if (isa<LoadInst>(inst))
+        return true;
+    if (isa<PHINode>(inst) || isa<AllocaInst>(inst) || inst->isTerminator() || inst->isEHPad()
+        || inst->getType()->isTokenTy())
+        return false;
+    if (CallBase *call = dyn_cast<CallBase>(inst))
+    {
+        if (call->isConvergent())
+            return false;
+    }
+    return !inst->mayHaveSideEffects() && !inst->mayReadFromMemory();
+}
+
+/** @brief Mark an Instruction if it is LoopInvariant. 
+ * A load is invariant if its address is invariant and no instruction of the loop may write the loaded memory.
  * 
  * @param inst instruction
  * @param L loop
+ * @param AA alias analysis
+ * @param table analysis results of the loop
 */
-void markIfLoopInvariant (Instruction *inst, Loop* L)
+void markIfLoopInvariant (Instruction *inst, Loop* L, AAResults *AA, LICMTable &table)
 {
-    Value *val1 = inst->getOperand(0);
-    Value *val2 = inst->getOperand(1);
+    if (LoadInst *load = dyn_cast<LoadInst>(inst))
+    {
+        if (!load->isSimple() || !isLoopInvariant(load->getPointerOperand(), L, table)
+            || mayBeClobbered(load, getLoopMemory(L, table), AA))
+            return;
 
-    #ifdef DEBUG
-        outs() << "[markIfLoopInvariant]\t\tAnalyzing operands: " << *val1 << ", " << *val2 << "\n";
-    #endif
-    
-    if (!isLoopInvariant(val1, L) || !isLoopInvariant(val2, L))
+        table.invariant.insert(inst);
+
+        #ifdef DEBUG
+            outs() << "[markIfLoopInvariant]\tLoop invariant load detected: " << *inst << "\n";
+        #endif
         return;
+    }
+
+    for (Value *val : inst->operands())
+    {
+        #ifdef DEBUG
+            outs() << "[markIfLoopInvariant]\t\tAnalyzing operand: " << *val << "\n";
+        #endif
 
-    applyMetadata(inst, invariant_tag);
+        if (!isLoopInvariant(val, L, table))
+            return;
+    }
+
+    table.invariant.insert(inst);
 
     #ifdef DEBUG
         outs() << "[markIfLoopInvariant]\tLoop invariant instruction detected: " << *inst << "\n";
@@ -106,21 +202,32 @@ void markIfLoopInvariant (Instruction *inst, Loop* L)
     return;
 }
 
-/** @brief Mark with a metadata all the blocks in the loop which dominate the exits. 
+/** @brief Check if a block dominates all the exiting blocks of a loop.
  * 
- * @param L Loop
+ * @param BB block
+ * @param exiting_blocks exiting blocks of the loop
  * @param DT dominator tree
 */
-void markExitsDominatorBlocks (Loop &L, DominatorTree *DT)
+bool dominatesExits (BasicBlock *BB, ArrayRef<BasicBlock*> exiting_blocks, DominatorTree *DT)
 {
-    SmallVector<BasicBlock*> exiting_blocks;
-
-    for (auto BI = L.block_begin(); BI != L.block_end(); ++BI)
+    for (auto EB: exiting_blocks)
     {
-        BasicBlock *BB = *BI;
-        if (L.isLoopExiting(BB))
-            exiting_blocks.push_back(BB);
+        if (!DT->dominates(BB, EB))
+            return false;
     }
+    return true;
+}
+
+/** @brief Mark all the blocks in the loop which dominate the exits. 
+ * 
+ * @param L Loop
+ * @param DT dominator tree
+ * @param table analysis results of the loop
+*/
+void markExitsDominatorBlocks (Loop &L, DominatorTree *DT, LICMTable &table)
+{
+    SmallVector<BasicBlock*> exiting_blocks;
+    L.getExitingBlocks(exiting_blocks);
 
     for (auto BI = L.block_begin(); BI != L.block_end(); ++BI)
     {
@@ -129,83 +236,97 @@ void markExitsDominatorBlocks (Loop &L, DominatorTree *DT)
             outs() << "[markExitsDominatorBlocks]\tAnalyzing block: " << *BI << "\n";
         #endif
 
-
-        bool is_dominator = true;
-        for (auto EB: exiting_blocks)
-        {
-            if (!DT->dominates(BB, EB))
-            {
-                is_dominator = false;
-                break;
-            }
-        }
-
-        if (is_dominator){
+        if (dominatesExits(BB, exiting_blocks, DT)){
             #ifdef DEBUG
                 outs() << "[markExitsDominatorBlocks]\t\tThis Block is dominator" << "\n";
             #endif
 
-            applyMetadata(BB->getTerminator(), exits_dominator);
+            table.exits_dominator.insert(BB);
         }
     }
     return;
 }
 
-/** @brief Recursively get Uses for a given Instruction.
+/** @brief Get Uses for a given Instruction, following the phis.
+ * The uses are computed once for each run, and visiting each phi only once: the phis of a loop may form cycles.
  * 
  * @param inst instruction
+ * @param table analysis results of the loop
 */
-std::vector<Use*> getUses (Instruction *inst)
+const std::vector<Use*> &getUses (Instruction *inst, LICMTable &table)
 {
-    std::vector<Use*> uses_to_check;
-    for (Value::use_iterator iter = inst->use_begin(); iter != inst->use_end(); ++iter)
+    auto [entry, is_new] = table.uses.try_emplace(inst);
+    std::vector<Use*> &uses_to_check = entry->second;
+    if (!is_new)
+        return uses_to_check;
+
+    SmallPtrSet<PHINode*, 8> visited;
+    SmallVector<Instruction*, 8> worklist = {inst};
+    while (!worklist.empty())
     {
-        Use *use_of_inst = &(*iter);
-        Instruction *user_inst = dyn_cast<Instruction>(iter->getUser());
-        
-        #ifdef DEBUG
-            outs() << "[getUses]\tFound User: " << *(user_inst) << " of " << *inst << "\n";
-        #endif
-        
-        /*
-            Given that a PHINode instruction stores different expressions connected to a variable; 
-            in order to obtain the uses of the original Instruction it is needed to obtain the uses of the PHI 
-            Instruction (this operation can be repeated multiple times).
-        */  
-        if (isa<PHINode>(user_inst))
+        Instruction *current = worklist.pop_back_val();
+        for (Use &use_of_inst : current->uses())
         {
-            std::vector<Use*> res = getUses(user_inst);
-            uses_to_check.insert(uses_to_check.end(), res.begin(), res.end());
+            Instruction *user_inst = cast<Instruction>(use_of_inst.getUser());
+            
+            #ifdef DEBUG
+                outs() << "[getUses]\tFound User: " << *(user_inst) << " of " << *current << "\n";
+            #endif
+            
+            /*
+                Given that a PHINode instruction stores different expressions connected to a variable; 
+                in order to obtain the uses of the original Instruction it is needed to obtain the uses of the PHI 
+                Instruction (this operation can be repeated multiple times).
+            */  
+            if (PHINode *phi = dyn_cast<PHINode>(user_inst))
+            {
+                if (visited.insert(phi).second)
+                    worklist.push_back(phi);
+            }
+            else
+                uses_to_check.push_back(&use_of_inst);
         }
-        else
-            uses_to_check.push_back(use_of_inst);
     }
-    outs()<<"\n";
     return uses_to_check;
 }
 
-/** @brief Mark the give instruction with a metadata if it dominates their uses.
+/** @brief Check if the given instruction dominates its uses in the loop.
  * 
  * @param inst instruction
  * @param DT dominator tree
  * @param L loop
+ * @param table analysis results of the loop
 */
-void markIfUseDominator (Instruction *inst, DominatorTree *DT, Loop *L)
+bool isUseDominator (Instruction *inst, DominatorTree *DT, Loop *L, LICMTable &table)
 {
-    std::vector<Use*> uses = getUses(inst);
+    const std::vector<Use*> &uses = getUses(inst, table);
     Value *inst_val = dyn_cast<Value>(inst);
 
     for (Use *use : uses)
     {
         #ifdef DEBUG
-        outs() << "[markIfUseDominator]\t"<< *inst_val << " is "<< ((DT->dominates(inst_val, *use)) ? "" : "not") << " a dominator of " << *(use->getUser()) <<"\n";
+        outs() << "[isUseDominator]\t"<< *inst_val << " is "<< ((DT->dominates(inst_val, *use)) ? "" : "not") << " a dominator of " << *(use->getUser()) <<"\n";
         #endif
 
         if (L->contains(dyn_cast<Instruction>(use->getUser())) && !DT->dominates(inst_val, *use))
-            return;
+            return false;
     }
+    return true;
+}
+
+/** @brief Mark the give instruction if it dominates their uses.
+ * 
+ * @param inst instruction
+ * @param DT dominator tree
+ * @param L loop
+ * @param table analysis results of the loop
+*/
+void markIfUseDominator (Instruction *inst, DominatorTree *DT, Loop *L, LICMTable &table)
+{
+    if (!isUseDominator(inst, DT, L, table))
+        return;
     
-    applyMetadata(inst, use_dominator);
+    table.use_dominator.insert(inst);
 
     #ifdef DEBUG
         outs() << "[markIfUseDominator]\tInstruction "<<*inst<<" marked as use dominator\n";
@@ -214,45 +335,148 @@ void markIfUseDominator (Instruction *inst, DominatorTree *DT, Loop *L)
     return;
 }
 
-/** @brief Mark the give instruction as dead if it is considered such outside the loop.
+/** @brief Check if the given instruction is dead outside the loop.
  * An instruction is dead in a fixed point p if it is never used from that point onwards.
  * 
  * @param inst instruction
  * @param L loop
+ * @param table analysis results of the loop
 */
-void markIfDeadInstruction (Instruction *inst, Loop *L)
+bool isDeadOutside (Instruction *inst, Loop *L, LICMTable &table)
 {
-    std::vector<Use*> uses = getUses(inst);
-    bool isDead = true;
+    const std::vector<Use*> &uses = getUses(inst, table);
     for (Use *use : uses)
     {
         User *user = use->getUser();
         Instruction *user_inst = dyn_cast<Instruction>(user);
         if (!L->contains(user_inst))
-        {
-            isDead = false;
-            break;
-        }
+            return false;
     }
+    return true;
+}
 
-    if (isDead)
-        applyMetadata(inst, dead_tag);
+/** @brief Mark the give instruction as dead if it is considered such outside the loop.
+ * 
+ * @param inst instruction
+ * @param L loop
+ * @param table analysis results of the loop
+*/
+void markIfDeadInstruction (Instruction *inst, Loop *L, LICMTable &table)
+{
+    if (isDeadOutside(inst, L, table))
+        table.dead.insert(inst);
     return;
 }
 
+/** @brief Check if the operands of an instruction are defined outside the loop.
+ * 
+ * @param inst instruction
+ * @param L loop
+*/
+bool hasOperandsOutside (Instruction *inst, Loop *L)
+{
+    for (Value *op : inst->operands())
+    {
+        Instruction *op_inst = dyn_cast<Instruction>(op);
+        if (op_inst && L->contains(op_inst))
+            return false;
+    }
+    return true;
+}
+
+/** @brief Check if an instruction can be executed in the preheader of a loop.
+ * An instruction which may trap (e.g. a division by a value which may be 0, or a load) must be executed in each
+ * iteration before the loop exits: its block dominates the exits, and the loop cannot be left otherwise.
+ * Being dead outside the loop is not enough, since it may not be executed at all; the instructions which cannot
+ * trap (isSafeToSpeculativelyExecute) can be moved in any case.
+ * 
+ * @param inst instruction
+ * @param dominates_exits true if the block of the instruction dominates the exits of the loop
+ * @param memory memory accesses of the loop
+*/
+bool isSafeToHoist (Instruction *inst, bool dominates_exits, const LoopMemory &memory)
+{
+    return (dominates_exits && !memory.may_throw) || isSafeToSpeculativelyExecute(inst);
+}
+
+/** @brief Find the outermost loop an instruction moved out of a loop can be moved out of.
+ * The instruction is moved out of the parent loops too, as long as in the parent loop its operands are invariant,
+ * it dominates its uses, and the preheader it would be moved to dominates the exits of the parent loop or the
+ * instruction is dead outside the parent loop. A load must not be clobbered in the parent loop either.
+ * 
+ * @param inst instruction moved out of L
+ * @param L loop
+ * @param DT dominator tree
+ * @param AA alias analysis
+ * @param table analysis results of the loop
+ * @return the outermost loop the instruction is moved out of
+*/
+Loop *getHoistTarget (Instruction *inst, Loop *L, DominatorTree *DT, AAResults *AA, LICMTable &table)
+{
+    Loop *target = L;
+    LoadInst *load = dyn_cast<LoadInst>(inst);
+    for (Loop *parent = L->getParentLoop(); parent && parent->getLoopPreheader(); parent = parent->getParentLoop())
+    {
+        SmallVector<BasicBlock*> exiting_blocks;
+        parent->getExitingBlocks(exiting_blocks);
+        bool dominates_exits = dominatesExits(target->getLoopPreheader(), exiting_blocks, DT);
+
+        // the operands which are moved out of the parent loop have already been moved, since they dominate inst
+        if (!hasOperandsOutside(inst, parent) || !isUseDominator(inst, DT, parent, table)
+            || (!dominates_exits && !isDeadOutside(inst, parent, table))
+            || !isSafeToHoist(inst, dominates_exits, getLoopMemory(parent, table)))
+            break;
+        if (load && mayBeClobbered(load, getLoopMemory(parent, table), AA))
+            break;
+        target = parent;
+    }
+    return target;
+}
+
+/** @brief Get the blocks of a loop in the preorder of the dominator tree.
+ * A definition dominates its uses, so the operands of an instruction (but phis) are visited before it.
+ * 
+ * @param L loop
+ * @param DT dominator tree
+*/
+SmallVector<BasicBlock*> getBlocksInDominatorOrder (Loop &L, DominatorTree *DT)
+{
+    SmallVector<BasicBlock*> blocks;
+    SmallVector<DomTreeNode*> stack = {DT->getNode(L.getHeader())};
+    while (!stack.empty())
+    {
+        DomTreeNode *node = stack.pop_back_val();
+        // the blocks of the loop are only dominated by the header and by other blocks of the loop
+        if (!L.contains(node->getBlock()))
+            continue;
+        blocks.push_back(node->getBlock());
+        for (DomTreeNode *child : reverse(node->children()))
+            stack.push_back(child);
+    }
+    return blocks;
+}
+
 /** @brief Move the marked instructions outside the loop.
  * Execute a DFS on the dominator tree in order to move in the preheader the instructions which are marked
  * as invariant, use dominators, and exits dominators or deads. 
- * The dfs is exploited to maintain the relative order of the moved instructions.
+ * The dfs is exploited to maintain the relative order of the moved instructions. It starts from the header of the
+ * loop, which dominates all the blocks of the loop, and does not visit the blocks outside the loop.
+ * An instruction is moved only if its operands have been moved before, and it is moved in the preheader of the
+ * outermost loop it is invariant in (see getHoistTarget).
  * 
  * @param node_DT dominator tree node
- * @param preheader preheader of the loop
+ * @param L loop
+ * @param DT dominator tree
+ * @param AA alias analysis
+ * @param MSSAU MemorySSA updater, nullptr if MemorySSA is not available
+ * @param table analysis results of the loop
 */
-bool codeMotion (DomTreeNode *node_DT, BasicBlock *preheader)
+bool codeMotion (DomTreeNode *node_DT, Loop &L, DominatorTree *DT, AAResults *AA, MemorySSAUpdater *MSSAU,
+                 LICMTable &table)
 {
     bool code_changed = false;
     SmallVector<Instruction*> to_be_moved;
-    if (!node_DT)
+    if (!node_DT || !L.contains(node_DT->getBlock()))
         return false;
     BasicBlock *node = node_DT->getBlock();
 
@@ -266,9 +490,11 @@ bool codeMotion (DomTreeNode *node_DT, BasicBlock *preheader)
             outs() << "[codeMotion]\t" << *inst << "\n";
         #endif
         // if at least one of the three main conditions is false, then the instruction must not be moved in preheader block
-        bool not_move = ((!inst->getMetadata(dead_tag) && !node->getTerminator()->getMetadata(exits_dominator)) 
-            || !inst->getMetadata(use_dominator) || !inst->getMetadata(invariant_tag));
-        clearMetadata(&(*inst));
+        Instruction *I = &(*inst);
+        bool not_move = ((!table.dead.count(I) && !table.exits_dominator.count(node)) 
+            || !table.use_dominator.count(I) || !table.invariant.count(I));
+        if (!not_move)
+            not_move = !isSafeToHoist(I, table.exits_dominator.count(node), getLoopMemory(&L, table));
         #ifdef DEBUG
             if (not_move)
                 outs() << "[codeMotion]\t\tThe instruction is moved\n";
@@ -278,12 +504,15 @@ bool codeMotion (DomTreeNode *node_DT, BasicBlock *preheader)
         to_be_moved.push_back(&(*inst));
     }
 
-    Instruction *last_preheader_inst = &(*(preheader->getTerminator()));
-
-    code_changed = (to_be_moved.size() >= 1);
-
     for (auto inst: to_be_moved)
     {
+        // an invariant operand which has not been moved is still defined in the loop
+        if (!hasOperandsOutside(inst, &L))
+            continue;
+
+        Instruction *last_preheader_inst = getHoistTarget(inst, &L, DT, AA, table)->getLoopPreheader()->getTerminator();
+        code_changed = true;
+
         // move inst in preheader
         #ifdef DEBUG
             outs() << "[codeMotion]\t" << "To be deleted inst " << *inst << "\n";
@@ -291,6 +520,11 @@ bool codeMotion (DomTreeNode *node_DT, BasicBlock *preheader)
         #endif
         inst->removeFromParent();
         inst->insertBefore(last_preheader_inst);
+        if (MSSAU)
+        {
+            if (MemoryUseOrDef *access = MSSAU->getMemorySSA()->getMemoryAccess(inst))
+                MSSAU->moveToPlace(access, last_preheader_inst->getParent(), MemorySSA::BeforeTerminator);
+        }
         #ifdef DEBUG
             outs() << "[codeMotion]\t" << "Newly inserted inst " << *inst << "\n";
         #endif
@@ -298,46 +532,531 @@ bool codeMotion (DomTreeNode *node_DT, BasicBlock *preheader)
 
     for (DomTreeNode *child : node_DT->children())
     {
-        code_changed = codeMotion(child, preheader) || code_changed;
+        code_changed = codeMotion(child, L, DT, AA, MSSAU, table) || code_changed;
     }
     return code_changed;
 }
 
+/**
+ * Promoter of the accesses to a memory location in a loop: the loads are replaced by the value the location
+ * holds, kept in a register (through phis), and the value is stored in the location at the exits of the loop.
+*/
+class LoopPromoter : public LoadAndStorePromoter
+{
+    Value *pointer;
+    SSAUpdater &SSA;
+    ArrayRef<BasicBlock*> exit_blocks;
+    Align alignment;
+    MemorySSAUpdater *MSSAU;
+
+    public:
+    LoopPromoter (Value *pointer, ArrayRef<Instruction*> accesses, SSAUpdater &SSA, ArrayRef<BasicBlock*> exit_blocks,
+                  Align alignment, MemorySSAUpdater *MSSAU)
+        : LoadAndStorePromoter(accesses, SSA, pointer->getName()), pointer(pointer), SSA(SSA),
+          exit_blocks(exit_blocks), alignment(alignment), MSSAU(MSSAU) {}
+
+    void doExtraRewritesBeforeFinalDeletion () override
+    {
+        for (BasicBlock *exit : exit_blocks)
+        {
+            Value *live_out = SSA.GetValueInMiddleOfBlock(exit);
+            StoreInst *store = new StoreInst(live_out, pointer, false, alignment, &*exit->getFirstInsertionPt());
+            if (MSSAU)
+            {
+                MemoryAccess *access = MSSAU->createMemoryAccessInBB(store, nullptr, exit, MemorySSA::Beginning);
+                MSSAU->insertDef(cast<MemoryDef>(access), true);
+            }
+        }
+    }
+
+    void instructionDeleted (Instruction *I) const override
+    {
+        if (MSSAU)
+            MSSAU->removeMemoryAccess(I);
+    }
+};
+
+/** @brief Promote a memory location to a register in a loop.
+ * The location is promoted if all its accesses in the loop are simple loads and stores of the same type through
+ * the same pointer, no other instruction of the loop may access it, and a store to it is executed in each
+ * iteration (so that loading it before the loop and storing it after the loop cannot trap).
+ * 
+ * @param pointer address of the location, defined outside the loop
+ * @param L loop
+ * @param DT dominator tree
+ * @param AA alias analysis
+ * @param MSSAU MemorySSA updater, nullptr if MemorySSA is not available
+ * @return true if the location has been promoted
+*/
+bool promotePointer (Value *pointer, Loop &L, DominatorTree *DT, AAResults *AA, MemorySSAUpdater *MSSAU)
+{
+    SmallVector<BasicBlock*> exiting_blocks, exit_blocks;
+    L.getExitingBlocks(exiting_blocks);
+    L.getUniqueExitBlocks(exit_blocks);
+    if (exit_blocks.empty())
+        return false;
+
+    SmallVector<Instruction*> accesses;
+    Type *type = nullptr;
+    Align alignment;
+    bool store_executed = false;
+
+    for (BasicBlock *BB : L.blocks())
+    {
+        for (Instruction &I : *BB)
+        {
+            if (!I.mayReadOrWriteMemory())
+                continue;
+            if (getLoadStorePointerOperand(&I) != pointer)
+                continue;
+
+            Type *access_type = isa<LoadInst>(I) ? I.getType() : cast<StoreInst>(I).getValueOperand()->getType();
+            bool simple = isa<LoadInst>(I) ? cast<LoadInst>(I).isSimple() : cast<StoreInst>(I).isSimple();
+            if (!simple || (type && access_type != type))
+                return false;
+            Align access_alignment = getLoadStoreAlignment(&I);
+
+            alignment = type ? std::min(alignment, access_alignment) : access_alignment;
+            type = access_type;
+            accesses.push_back(&I);
+            if (isa<StoreInst>(I) && dominatesExits(BB, exiting_blocks, DT))
+                store_executed = true;
+        }
+    }
+    if (!store_executed)
+        return false;
+
+    // no other instruction may access the location
+    const DataLayout &DL = L.getHeader()->getModule()->getDataLayout();
+    MemoryLocation location(pointer, LocationSize::precise(DL.getTypeStoreSize(type)));
+    SmallPtrSet<Instruction*, 8> promoted(accesses.begin(), accesses.end());
+    for (BasicBlock *BB : L.blocks())
+    {
+        for (Instruction &I : *BB)
+        {
+            if (I.mayReadOrWriteMemory() && !promoted.count(&I) && !isNoModRef(AA->getModRefInfo(&I, location)))
+                return false;
+        }
+    }
+
+    #ifdef DEBUG
+        outs() << "[promotePointer]\tPromoting " << *pointer << " (" << accesses.size() << " accesses)\n";
+    #endif
+
+    BasicBlock *preheader = L.getLoopPreheader();
+    SmallVector<PHINode*, 16> new_phis;
+    SSAUpdater SSA(&new_phis);
+    LoopPromoter promoter(pointer, accesses, SSA, exit_blocks, alignment, MSSAU);
+
+    LoadInst *preheader_load = new LoadInst(type, pointer, pointer->getName() + ".promoted", false, alignment,
+                                            preheader->getTerminator());
+    if (MSSAU)
+    {
+        MemoryAccess *access = MSSAU->createMemoryAccessInBB(preheader_load, nullptr, preheader, MemorySSA::End);
+        MSSAU->insertUse(cast<MemoryUse>(access), true);
+    }
+    SSA.AddAvailableValue(preheader, preheader_load);
+
+    promoter.run(accesses);
+
+    // the location may be only written in the loop
+    if (preheader_load->use_empty())
+    {
+        if (MSSAU)
+            MSSAU->removeMemoryAccess(preheader_load);
+        preheader_load->eraseFromParent();
+    }
+    return true;
+}
+
+/** @brief Promote to registers the memory locations stored by the loop through an invariant address.
+ * The loop accumulating in a location (e.g. a[k] += x[i]) becomes a loop accumulating in a register, which is
+ * loaded before the loop and stored at its exits.
+ * 
+ * @param L loop
+ * @param LAR standard analysis results of the loop
+ * @param MSSAU MemorySSA updater, nullptr if MemorySSA is not available
+ * @param table analysis results of the loop
+ * @return true if a location has been promoted
+*/
+bool promoteMemoryToRegisters (Loop &L, LoopStandardAnalysisResults &LAR, MemorySSAUpdater *MSSAU, LICMTable &table)
+{
+    const LoopMemory &memory = getLoopMemory(&L, table);
+    if (memory.may_throw || !L.getLoopPreheader() || !L.hasDedicatedExits())
+        return false;
+
+    SmallSetVector<Value*, 8> pointers;
+    for (Instruction *write : memory.writes)
+    {
+        StoreInst *store = dyn_cast<StoreInst>(write);
+        if (!store)
+            continue;
+        Instruction *pointer = dyn_cast<Instruction>(store->getPointerOperand());
+        if (!pointer || !L.contains(pointer))
+            pointers.insert(store->getPointerOperand());
+    }
+
+    bool promoted = false;
+    for (Value *pointer : pointers)
+        promoted = promotePointer(pointer, L, &LAR.DT, &LAR.AA, MSSAU) || promoted;
+
+    if (promoted)
+    {
+        // the values stored at the exits are defined in the loop
+        formLCSSA(L, LAR.DT, &LAR.LI, &LAR.SE);
+        LAR.SE.forgetLoop(&L);
+    }
+    return promoted;
+}
+
+/** @brief Check if a phi only forwards an instruction of the loop to an exit block (LCSSA phi).
+ *
+ * @param phi phi
+ * @param inst instruction
+ * @param L loop
+*/
+bool isLCSSAPhi (PHINode *phi, Instruction *inst, Loop &L)
+{
+    if (L.contains(phi))
+        return false;
+    for (unsigned i = 0; i < phi->getNumIncomingValues(); i++)
+    {
+        if (phi->getIncomingValue(i) != inst || !L.contains(phi->getIncomingBlock(i)))
+            return false;
+    }
+    return true;
+}
+
+/** @brief Sink to the exit blocks an instruction of the loop which is only used after the loop.
+ * Only the value of the last iteration is used, hence the instruction is computed once in each exit block using
+ * it instead of once per iteration. Its users must be the LCSSA phis of the exits, which are replaced by the sunk
+ * copies, or instructions already sunk in the exits.
+ * The operands are computed before the instruction in the last iteration, hence they are available at the exits
+ * (through the LCSSA phis added by formLCSSA).
+ *
+ * @param inst instruction
+ * @param L loop
+ * @param sunk instructions sunk in the exit blocks, updated with the new copies
+ * @return true if the instruction has been sunk (and erased)
+*/
+bool sinkToExits (Instruction *inst, Loop &L, SmallPtrSetImpl<Instruction*> &sunk)
+{
+    if (inst->use_empty())
+        return false;
+
+    SmallSetVector<PHINode*, 4> phis;
+    for (User *user : inst->users())
+    {
+        Instruction *user_inst = cast<Instruction>(user);
+        PHINode *phi = dyn_cast<PHINode>(user_inst);
+        if (phi && isLCSSAPhi(phi, inst, L) && phi->getParent()->getFirstInsertionPt() != phi->getParent()->end())
+            phis.insert(phi);
+        else if (!sunk.count(user_inst))
+            return false;
+    }
+
+    #ifdef DEBUG
+        outs() << "[sinkToExits]\tSinking " << *inst << "\n";
+    #endif
+
+    // one copy for each exit block, placed before the copies of its users
+    DenseMap<BasicBlock*, Instruction*> copies;
+    auto getCopy = [&](BasicBlock *exit)
+    {
+        Instruction *&copy = copies[exit];
+        if (!copy)
+        {
+            copy = inst->clone();
+            copy->insertBefore(&*exit->getFirstInsertionPt());
+            sunk.insert(copy);
+        }
+        return copy;
+    };
+
+    for (Use &use : make_early_inc_range(inst->uses()))
+    {
+        Instruction *user = cast<Instruction>(use.getUser());
+        if (!isa<PHINode>(user))
+            use.set(getCopy(user->getParent()));
+    }
+    for (PHINode *phi : phis)
+    {
+        phi->replaceAllUsesWith(getCopy(phi->getParent()));
+        phi->eraseFromParent();
+    }
+    std::string name = inst->getName().str();
+    inst->eraseFromParent();
+    for (auto &[exit, copy] : copies)
+        copy->setName(name);
+    return true;
+}
+
+/** @brief Get the block of the loop where an instruction can be sunk to skip the iterations not using it.
+ * The block is the nearest common dominator of the uses (for a phi, the end of the incoming block). It must be in
+ * the loop but not in a subloop (which would compute the instruction more times), and must not dominate the
+ * latches, i.e. it is on the cold side of a branch of the loop.
+ *
+ * @param inst instruction
+ * @param L loop
+ * @param DT dominator tree
+ * @param LI loop info
+ * @return the block, nullptr if the instruction cannot be sunk
+*/
+BasicBlock *getSinkBlock (Instruction *inst, Loop &L, DominatorTree *DT, LoopInfo *LI)
+{
+    BasicBlock *block = nullptr;
+    for (Use &use : inst->uses())
+    {
+        Instruction *user = cast<Instruction>(use.getUser());
+        BasicBlock *use_block = user->getParent();
+        if (PHINode *phi = dyn_cast<PHINode>(user))
+            use_block = phi->getIncomingBlock(use);
+        if (!L.contains(use_block))
+            return nullptr;
+        block = block ? DT->findNearestCommonDominator(block, use_block) : use_block;
+    }
+    if (!block || block == inst->getParent() || LI->getLoopFor(block) != &L
+        || block->getFirstInsertionPt() == block->end())
+        return nullptr;
+
+    SmallVector<BasicBlock*> latches;
+    L.getLoopLatches(latches);
+    for (BasicBlock *latch : latches)
+    {
+        if (DT->dominates(block, latch))
+            return nullptr;
+    }
+    return block;
+}
+
+/** @brief Sink the instructions of the loop which are not needed in every iteration.
+ * The instructions only used after the loop are sunk to the exit blocks (see sinkToExits), the others are sunk
+ * to the cold side of the branches they are used in (see getSinkBlock).
+ * The blocks are visited in reverse dominator order, so that the users are sunk before their operands, which may
+ * then follow them. Only the instructions which cannot access memory are sunk, and the ones of the subloops are
+ * left to the subloops.
+ *
+ * @param L loop
+ * @param LAR standard analysis results of the loop
+ * @param erased instructions of the loop erased after being sunk to the exits
+ * @return true if an instruction has been sunk
+*/
+bool sinkInstructions (Loop &L, LoopStandardAnalysisResults &LAR, SmallVectorImpl<Instruction*> &erased)
+{
+    SmallPtrSet<Instruction*, 16> sunk;
+    unsigned partially_sunk = 0;
+
+    SmallVector<BasicBlock*> blocks = getBlocksInDominatorOrder(L, &LAR.DT);
+    for (BasicBlock *BB : reverse(blocks))
+    {
+        if (LAR.LI.getLoopFor(BB) != &L)
+            continue;
+
+        // the instructions are moved while visiting the block
+        SmallVector<Instruction*> instructions;
+        for (Instruction &I : reverse(*BB))
+        {
+            if (isCandidate(&I) && !isa<LoadInst>(I))
+                instructions.push_back(&I);
+        }
+
+        for (Instruction *inst : instructions)
+        {
+            if (sinkToExits(inst, L, sunk))
+            {
+                erased.push_back(inst);
+                continue;
+            }
+            if (BasicBlock *block = getSinkBlock(inst, L, &LAR.DT, &LAR.LI))
+            {
+                #ifdef DEBUG
+                    outs() << "[sinkInstructions]\tSinking " << *inst << " to " << block->getName() << "\n";
+                #endif
+                inst->moveBefore(&*block->getFirstInsertionPt());
+                partially_sunk++;
+            }
+        }
+    }
+
+    if (!erased.empty())
+    {
+        // the operands of the sunk instructions are defined in the loop
+        formLCSSA(L, LAR.DT, &LAR.LI, &LAR.SE);
+        LAR.SE.forgetLoop(&L);
+    }
+    return !erased.empty() || partially_sunk;
+}
+
+/** @brief Check if alias analysis prevents moving a memory access of the loop through an invariant address.
+ * A load is blocked by the writes which may alias it (see mayBeClobbered), a store by any other access which may
+ * alias it (see promotePointer).
+ *
+ * @param L loop
+ * @param AA alias analysis
+ * @param SE scalar evolution
+*/
+bool hasAliasBlockedAccess (Loop &L, AAResults *AA, ScalarEvolution *SE)
+{
+    SmallVector<Instruction*> accesses;
+    for (BasicBlock *BB : L.blocks())
+    {
+        for (Instruction &I : *BB)
+        {
+            if (I.mayReadOrWriteMemory())
+                accesses.push_back(&I);
+        }
+    }
+
+    for (Instruction *access : accesses)
+    {
+        // the address may be computed in the loop, and moved out of it by the code motion
+        Value *pointer = getLoadStorePointerOperand(access);
+        if (!pointer || !SE->isLoopInvariant(SE->getSCEV(pointer), &L))
+            continue;
+
+        MemoryLocation location = MemoryLocation::get(access);
+        for (Instruction *other : accesses)
+        {
+            if (other == access || getLoadStorePointerOperand(other) == pointer)
+                continue;
+            if (!isa<StoreInst>(access) && !other->mayWriteToMemory())
+                continue;
+            if (!isNoModRef(AA->getModRefInfo(other, location)))
+                return true;
+        }
+    }
+    return false;
+}
+
+/** @brief Version a loop on the absence of aliasing between its memory accesses.
+ * When alias analysis cannot prove that the accesses through an address defined outside the loop are independent
+ * of the other accesses, the loop is cloned under a runtime check of the overlap of the address ranges of its
+ * accesses (computed by LoopAccessInfo from SCEV). The accesses of the original loop, executed when no range
+ * overlaps, are annotated as not aliasing, hence the code motion and the promotion can move them; the copy,
+ * executed otherwise, is left as is.
+ * Only innermost loops in simplified form with a single exit are versioned, at most once, and only if the number
+ * of checks is within loopopts-max-runtime-checks. The clone is not known by MemorySSA, hence the loops are not
+ * versioned when MemorySSA is available.
+ *
+ * @param L loop
+ * @param LAR standard analysis results of the loop
+ * @return the copy of the loop executed when the ranges overlap, nullptr if the loop has not been versioned
+*/
+Loop *versionLoop (Loop &L, LoopStandardAnalysisResults &LAR)
+{
+    if (LAR.MSSA || !LoopOptsMaxRuntimeChecks || !L.isInnermost() || !L.isLoopSimplifyForm() || !L.getExitBlock()
+        || findStringMetadataForLoop(&L, "llvm.loop.licm_versioning.disable") || !hasAliasBlockedAccess(L, &LAR.AA, &LAR.SE))
+        return nullptr;
+
+    LoopAccessInfo LAI(&L, &LAR.SE, &LAR.TLI, &LAR.AA, &LAR.DT, &LAR.LI);
+    const auto &checks = LAI.getRuntimePointerChecking()->getChecks();
+    if (!LAI.canVectorizeMemory() || checks.empty() || checks.size() > LoopOptsMaxRuntimeChecks)
+        return nullptr;
+
+    #ifdef DEBUG
+        outs() << "[versionLoop]\tVersioning loop " << L.getHeader()->getName() << " (" << checks.size()
+               << " runtime checks)\n";
+    #endif
+
+    LoopVersioning versioning(LAI, checks, &L, &LAR.LI, &LAR.DT, &LAR.SE);
+    versioning.versionLoop();
+    versioning.annotateLoopWithNoAlias();
+
+    // neither version is versioned again
+    Loop *copy = versioning.getNonVersionedLoop();
+    addStringMetadataToLoop(&L, "llvm.loop.licm_versioning.disable");
+    addStringMetadataToLoop(copy, "llvm.loop.licm_versioning.disable");
+    return copy;
+}
+
+AnalysisKey LoopOptsVariantAnalysis::Key;
 
 PreservedAnalyses LoopOpts::run (Loop &L, LoopAnalysisManager &LAM, 
                                     LoopStandardAnalysisResults &LAR, LPMUpdater &LU)
 {
     DominatorTree *DT = &LAR.DT;
+    AAResults *AA = &LAR.AA;
+    std::optional<MemorySSAUpdater> MSSAU;
+    if (LAR.MSSA)
+        MSSAU.emplace(LAR.MSSA);
+    MemorySSAUpdater *updater = MSSAU ? &*MSSAU : nullptr;
+    LICMTable table;
+
+    // the copy of a versioned loop is optimized as well, without the runtime checks
+    bool versioned = false;
+    if (Loop *copy = versionLoop(L, LAR))
+    {
+        LU.addSiblingLoops({copy});
+        versioned = true;
+    }
+
+    // instructions of the subloops which are not invariant in them
+    SmallPtrSet<Instruction*, 32> &variant = LAM.getResult<LoopOptsVariantAnalysis>(L, LAR).variant;
+    variant.clear();
+    for (Loop *subloop : L.getSubLoops())
+    {
+        auto *summary = LAM.getCachedResult<LoopOptsVariantAnalysis>(*subloop);
+        if (!summary)
+            continue;
+        variant.insert(summary->variant.begin(), summary->variant.end());
+        summary->variant.clear();
+    }
     
     #ifdef DEBUG
         outs() << "[run]\tPre-header: " << *(L.getLoopPreheader()) << "\n";
         outs() << "[run]\tHeader: " << *(L.getHeader()) << "\n";
     #endif
-    for (auto BI = L.block_begin(); BI != L.block_end(); ++BI)
+    // in dominator order the operands are analyzed before their users, so a single visit reaches the fixpoint
+    for (BasicBlock *BB : getBlocksInDominatorOrder(L, DT))
     {
-        BasicBlock *BB = *BI;
         #ifdef DEBUG
             outs() << "[run]\tBasic block: " << *BB << "\n";
         #endif
         for (auto i = BB->begin(); i != BB->end(); i++)
         {
             Instruction *inst = dyn_cast<Instruction>(i);
-            if (!inst->isBinaryOp())
+            if (!isCandidate(inst) || variant.count(inst))
                 continue;
             #ifdef DEBUG
                 outs() << "[run]\tInstruction: " << *inst << "\n";
             #endif
             
-            markIfLoopInvariant(inst, &L);
-            markIfUseDominator(inst, DT, &L);
-            markIfDeadInstruction(inst, &L);
+            markIfLoopInvariant(inst, &L, AA, table);
+            if (!table.invariant.count(inst))
+            {
+                variant.insert(inst);
+                continue;
+            }
+            markIfUseDominator(inst, DT, &L, table);
+            markIfDeadInstruction(inst, &L, table);
         }
     }
 
-    markExitsDominatorBlocks(L, DT);
+    markExitsDominatorBlocks(L, DT, table);
+
+    bool code_changed = codeMotion(DT->getNode(L.getHeader()), L, DT, AA, updater, table);
+    // the addresses moved out of the loop may now be promoted
+    code_changed = promoteMemoryToRegisters(L, LAR, updater, table) || code_changed;
 
-    if (codeMotion(DT->getRootNode(), L.getLoopPreheader()))
-        return PreservedAnalyses::none();
+    SmallVector<Instruction*> erased;
+    code_changed = sinkInstructions(L, LAR, erased) || code_changed || versioned;
+    for (Instruction *inst : erased)
+        variant.erase(inst);
+
+    // the summary is only needed by the parent loop
+    if (L.isOutermost())
+        variant.clear();
+
+    if (code_changed)
+    {
+        // the instructions are only moved between blocks, and the versioning updates the dominator tree and the
+        // loops: they are still valid, as well as MemorySSA (which is kept updated)
+        PreservedAnalyses PA = getLoopPassPreservedAnalyses();
+        PA.preserve<LoopOptsVariantAnalysis>();
+        if (LAR.MSSA)
+            PA.preserve<MemorySSAAnalysis>();
+        return PA;
+    }
 
     #ifdef DEBUG
         outs()<<"[run]\tNothing changed!"<<"\n";
@@ -3,9 +3,34 @@
 
 #include "llvm/IR/PassManager.h"
 #include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/ADT/SmallPtrSet.h"
 
 namespace llvm
 {
+    /*
+        Instructions found not to be invariant in a loop by LoopOpts; since loops are visited from the innermost
+        to the outermost one, the summary of a subloop is reused (and then emptied) by the parent loop, where they
+        are not invariant either.
+        The analysis only creates an empty summary, which is filled by LoopOpts: being a loop analysis, it is dropped
+        by the loop analysis manager when the loop is deleted or changed by a pass which does not preserve it.
+    */
+    class LoopOptsVariantAnalysis : public AnalysisInfoMixin<LoopOptsVariantAnalysis>
+    {
+        friend AnalysisInfoMixin<LoopOptsVariantAnalysis>;
+        static AnalysisKey Key;
+
+        public:
+        struct Result
+        {
+            SmallPtrSet<Instruction*, 32> variant;
+        };
+
+        Result run (Loop &L, LoopAnalysisManager &LAM, LoopStandardAnalysisResults &LAR)
+        {
+            return Result();
+        }
+    };
+
     class LoopOpts : public PassInfoMixin<LoopOpts>
     {
         public:
@@ -8,23 +8,316 @@
 
 #include "llvm/Transforms/Utils/LocalOpts.h"
 #include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
-#include "unordered_set"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ThreadPool.h"
+#include <mutex>
+#include <optional>
 
 using namespace llvm;
 
+static cl::opt<unsigned> LocalOptsThreads("localopts-threads", cl::init(1),
+  cl::desc("Number of threads optimizing the functions of a module in parallel (0 = one per hardware thread)"));
+
 /**
 * Map associating binary operations with their opposite operation
-* Signed operations are excluded
+* Signed operations are excluded; divisions and right shifts are excluded as well, since they drop the low bits
+* of the value, hence a following multiplication or left shift does not restore it (e.g. (7 / 2) * 2 = 6).
+* Multiplications and left shifts drop the high bits instead, hence they are cancelled only when flagged nuw
+* (e.g. (x << 3) >> 3 is not x if the top 3 bits of x are set), see MultiInstructionOpt
 */
 const std::unordered_map<Instruction::BinaryOps, Instruction::BinaryOps> oppositeOp =
 {
   {Instruction::Add, Instruction::Sub},
   {Instruction::Sub, Instruction::Add},
   {Instruction::Mul, Instruction::UDiv},
-  {Instruction::UDiv, Instruction::Mul},
-  {Instruction::Shl, Instruction::LShr},
-  {Instruction::LShr, Instruction::Shl}
+  {Instruction::Shl, Instruction::LShr}
+};
+
+/**
+ * Worklist of the binary instructions of a basic block which still have to be visited by the optimizations.
+ * Only the instructions affected by a rewrite are (re)inserted, hence a block is not rescanned after each change.
+ * Instructions are popped in LIFO order; an instruction already pending is not inserted twice, and an erased
+ * instruction is removed from the pending set so that its stale entry is skipped.
+ *
+ * The worklist is the scratch state of a single worker and it is reused for all the blocks of a function.
+ * Every change to the IR goes through it: when functions are optimized in parallel, the changes that touch the
+ * LLVMContext shared by the module (constants creation and the use lists of constants) are serialized by ContextLock.
+*/
+class LocalOptsWorklist
+{
+  BasicBlock *B = nullptr;
+  SmallVector<Instruction*, 64> Stack;
+  SmallPtrSet<Instruction*, 32> Pending;
+  // ranks of the arguments and of the instructions of the function, see rank()
+  DenseMap<Value*, unsigned> Ranks;
+  // lock shared by the parallel workers, nullptr when the functions are optimized sequentially
+  std::mutex *ContextLock;
+
+  std::unique_lock<std::mutex> lockContext ()
+  {
+    return ContextLock ? std::unique_lock<std::mutex>(*ContextLock) : std::unique_lock<std::mutex>();
+  }
+
+public:
+  LocalOptsWorklist (std::mutex *ContextLock = nullptr) : ContextLock(ContextLock) {}
+
+  /**
+   * Rank the values of a function, before optimizing its blocks: arguments are ranked in their order, followed by
+   * the instructions in program order, while constants and globals have rank 0.
+   * Ranks give a deterministic order to the operands of reassociated expressions.
+  */
+  void rank (Function &F)
+  {
+    Ranks.clear();
+    unsigned R = 0;
+    for (Argument &Arg : F.args())
+      Ranks[&Arg] = ++R;
+    for (Instruction &I : instructions(F))
+      Ranks[&I] = ++R;
+  }
+
+  unsigned getRank (Value *V) const
+  {
+    return Ranks.lookup(V);
+  }
+
+  /**
+   * Start the optimization of a new basic block, the worklist must be empty.
+  */
+  void reset (BasicBlock &BB)
+  {
+    B = &BB;
+    Stack.clear();
+    Pending.clear();
+  }
+
+  /**
+   * Insert a value in the worklist if it is a binary instruction of the block being optimized.
+  */
+  void push (Value *V)
+  {
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (I && I->isBinaryOp() && I->getParent() == B && Pending.insert(I).second)
+      Stack.push_back(I);
+  }
+
+  /**
+   * Get the next instruction to visit, nullptr if the worklist is empty.
+  */
+  Instruction *pop ()
+  {
+    while (!Stack.empty())
+    {
+      Instruction *I = Stack.pop_back_val();
+      if (Pending.erase(I))
+        return I;
+    }
+    return nullptr;
+  }
+
+  /**
+   * Get an integer constant of the given type; for vector types, V is splatted in every lane.
+  */
+  Constant *getConstant (Type *Ty, const APInt &V)
+  {
+    auto Lock = lockContext();
+    return ConstantInt::get(Ty, V);
+  }
+
+  /**
+   * Get an integer constant of the given type, with a value for each lane (a single one for scalar types).
+  */
+  Constant *getConstant (Type *Ty, ArrayRef<APInt> Lanes)
+  {
+    auto Lock = lockContext();
+    if (!Ty->isVectorTy())
+      return ConstantInt::get(Ty, Lanes.front());
+    SmallVector<Constant*, 16> Elements;
+    for (const APInt &Lane : Lanes)
+      Elements.push_back(ConstantInt::get(Ty->getScalarType(), Lane));
+    return ConstantVector::get(Elements);
+  }
+
+  /**
+   * Create a binary instruction which is not inserted in any block yet.
+  */
+  Instruction *create (Instruction::BinaryOps Op, Value *V1, Value *V2)
+  {
+    auto Lock = lockContext();
+    return BinaryOperator::Create(Op, V1, V2);
+  }
+
+  /**
+   * Create an integer cast of V to integers of the given width (in every lane, for vectors), which is not inserted
+   * in any block yet.
+  */
+  Instruction *createCast (Instruction::CastOps Op, Value *V, unsigned BitWidth)
+  {
+    auto Lock = lockContext();
+    return CastInst::Create(Op, V, V->getType()->getWithNewBitWidth(BitWidth));
+  }
+
+  /**
+   * Replace all the uses of inst with V, the users of inst are inserted in the worklist since their operands
+   * changed, while inst is inserted since it is now dead.
+  */
+  void replaceAllUsesWith (Instruction &inst, Value *V)
+  {
+    for (User *U : inst.users())
+      push(U);
+    {
+      auto Lock = lockContext();
+      inst.replaceAllUsesWith(V);
+    }
+    push(&inst);
+  }
+
+  /**
+   * Insert a newly created instruction after pos and in the worklist.
+  */
+  void insertAfter (Instruction *inst, Instruction *pos)
+  {
+    inst->insertAfter(pos);
+    push(inst);
+    // a new instruction is ranked right after the highest ranked of its operands
+    unsigned R = 0;
+    for (Value *Op : inst->operands())
+      R = std::max(R, getRank(Op));
+    Ranks[inst] = R + 1;
+  }
+
+  /**
+   * Erase a dead instruction, its operands are inserted in the worklist since they lost a use.
+  */
+  void eraseFromParent (Instruction &inst)
+  {
+    Pending.erase(&inst);
+    Ranks.erase(&inst);
+    for (Value *Op : inst.operands())
+      push(Op);
+    auto Lock = lockContext();
+    inst.eraseFromParent();
+  }
+};
+
+/**
+ * Get the integer constant, or the fixed width vector of integer constants, represented by a value.
+ * Vectors with a lane which is not an integer constant (e.g. undef) are not considered constants.
+ * The lanes of the constants are read without creating new constants (see getLanes), hence the functions reading
+ * them do not need the ContextLock of the worklist.
+ *
+ * @param V the value
+ * @return the constant, nullptr if V is not an integer constant
+*/
+Constant *getIntConstant (Value *V)
+{
+  Constant *C = dyn_cast<Constant>(V);
+  if (!C || !C->getType()->isIntOrIntVectorTy() || isa<ScalableVectorType>(C->getType()))
+    return nullptr;
+  // the elements of a ConstantDataVector of integer type are always integers
+  if (isa<ConstantInt>(C) || isa<ConstantAggregateZero>(C) || isa<ConstantDataVector>(C))
+    return C;
+  if (!isa<ConstantVector>(C))
+    return nullptr;
+  for (Value *Element : C->operands())
+    if (!isa<ConstantInt>(Element))
+      return nullptr;
+  return C;
+}
+
+/**
+ * Get the value of a lane of a constant returned by getIntConstant.
+ * Constant::getAggregateElement is not used, since it creates a ConstantInt for the lanes of a ConstantDataVector
+ * and of a ConstantAggregateZero, which would modify the LLVMContext.
+ *
+ * @param C the constant
+ * @param i the index of the lane, 0 for a scalar
+ * @return the value of the lane
+*/
+APInt getLane (Constant *C, unsigned i)
+{
+  if (ConstantInt *CI = dyn_cast<ConstantInt>(C))
+    return CI->getValue();
+  if (ConstantDataVector *CDV = dyn_cast<ConstantDataVector>(C))
+    return CDV->getElementAsAPInt(i);
+  if (isa<ConstantAggregateZero>(C))
+    return APInt(C->getType()->getScalarSizeInBits(), 0);
+  return cast<ConstantInt>(C->getOperand(i))->getValue();
+}
+
+/**
+ * Get the values of the lanes of a constant returned by getIntConstant; a scalar has a single lane.
+ *
+ * @param C the constant
+ * @param Lanes the values of the lanes
+*/
+void getLanes (Constant *C, SmallVectorImpl<APInt> &Lanes)
+{
+  auto *VTy = dyn_cast<FixedVectorType>(C->getType());
+  for (unsigned i = 0, n = VTy ? VTy->getNumElements() : 1; i < n; i++)
+    Lanes.push_back(getLane(C, i));
+}
+
+/**
+ * Get the value of a constant returned by getIntConstant, if it is the same in all the lanes.
+ *
+ * @param C the constant
+ * @return the value of the lanes, std::nullopt if the lanes differ
+*/
+std::optional<APInt> getSplat (Constant *C)
+{
+  APInt Splat = getLane(C, 0);
+  if (auto *VTy = dyn_cast<FixedVectorType>(C->getType()))
+    for (unsigned i = 1; i < VTy->getNumElements(); i++)
+      if (getLane(C, i) != Splat)
+        return std::nullopt;
+  return Splat;
+}
+
+/**
+ * Get the base 2 logarithm of every lane of a constant, if all the lanes are powers of two.
+ *
+ * @param C the constant
+ * @param Log2s the logarithms of the lanes
+ * @return true if all the lanes are powers of two, false otherwise
+*/
+bool getLog2Lanes (Constant *C, SmallVectorImpl<APInt> &Log2s)
+{
+  getLanes(C, Log2s);
+  for (APInt &Lane : Log2s)
+  {
+    if (!Lane.isPowerOf2())
+      return false;
+    Lane = APInt(Lane.getBitWidth(), Lane.logBase2());
+  }
+  return true;
+}
+
+/**
+ * Representation of a single variable binary operation in terms of a couple generic value - integer constant
+ * (e.g. X + 1), computed by getValAndConst.
+ * The constant is either an integer or a fixed width vector of integers: the lane-wise checks are done once, when
+ * the instruction is matched, so that every optimization for scalars applies as is to splat vectors.
+ * It is a plain value type: matching an instruction never allocates (for constants up to 64 bits), and the
+ * representation is only valid as long as the operands of the matched instruction are not changed.
+*/
+struct ValAndConst
+{
+  // the operand which is not the constant (or the first constant, if both operands are constants)
+  Value *Val = nullptr;
+  // the constant operand; nullptr if a constant is not present or it is present in the wrong position
+  Constant *Const = nullptr;
+  // the value of the constant, if it is the same in all the lanes (always, for scalars); std::nullopt otherwise
+  std::optional<APInt> Splat;
+  // number of integer constants in the binary instruction
+  size_t NConstants = 0;
 };
 
 /**
@@ -32,111 +325,129 @@ const std::unordered_map<Instruction::BinaryOps, Instruction::BinaryOps> opposit
  * (e.g. X + 1).
  * For commutative operations, the positions of the operands in the original instruction are swapped, instead,
  * in case of subtractions and divisions, a valid representaton is returned only in case the value is at the first place.
- * In case of subtractions and divisions where the only constant is the first operand, the second attribute 
- * in the returned pair will be nullptr.
+ * In case of subtractions and divisions where the only constant is the first operand, the constant
+ * in the returned representation will be nullptr.
  * 
  * The value represents the generic content of a SSA registry and is a Value*. The Value type is necessary in order to include
  * also the Argument objects (representig function's arguments), and Constant objects (in case there are two of them).
  * The function assumes that inst is a binary operation.
  * 
  * @param inst the binary instruction
- * @return a pair of a Value object and a constant; if a constant is not present or it is present in the wrong position
+ * @return a Value object and a constant; if a constant is not present or it is present in the wrong position
  * in case of subtraction and division, it returns a nullptr in its place, and the value returned is the first operand
  * 
 */
-std::pair<Value*, ConstantInt*>* getValAndConst (Instruction &inst)
+ValAndConst getValAndConst (Instruction &inst)
 {
   unsigned int opcode = inst.getOpcode();
   Value *val1 = inst.getOperand(0);
   Value *val2 = inst.getOperand(1);
-  ConstantInt *CI = dyn_cast<ConstantInt>(val1);
-  if ((opcode == BinaryOperator::Add || opcode == BinaryOperator::Mul) && CI)
+  Constant *C1 = getIntConstant(val1);
+  Constant *C2 = getIntConstant(val2);
+
+  ValAndConst VC;
+  VC.NConstants = (C1 ? 1 : 0) + (C2 ? 1 : 0);
+  if ((opcode == BinaryOperator::Add || opcode == BinaryOperator::Mul) && C1)
   {
-    return new std::pair<Value*, ConstantInt*> (val2, CI);
+    VC.Val = val2;
+    VC.Const = C1;
   }
   else
   {
     /**
-    * if val2 is not castable to ConstantInt the second entity of the pair is nullptr
+    * if val2 is not an integer constant the constant is nullptr
     * in case val1 and val2 are both constants and the operation is not Add or Mul, the value is actually the first constant
     * and the constant is the second one
     */
-    return new std::pair<Value*, ConstantInt*> (val1, dyn_cast<ConstantInt>(val2));
+    VC.Val = val1;
+    VC.Const = C2;
   }
-  return nullptr;
-}
-
-/**
- * Get the number of integer constants in the binary instruction.
- * 
- * @param inst the binary instruction
- * @return the number of integer constants
-*/
-size_t getNConstants (Instruction &inst)
-{
-  ConstantInt *C1 = dyn_cast<ConstantInt>(inst.getOperand(0));
-  ConstantInt *C2 = dyn_cast<ConstantInt>(inst.getOperand(1));
-  size_t counter = 0;
-  if (C1)
-    counter++;
-  if (C2)
-    counter++;
-  return counter;
+  if (VC.Const)
+    VC.Splat = getSplat(VC.Const);
+  return VC;
 }
 
 /** @brief Apply constant folding optimization on a binary instruction and susbtitute the instruction uses, if possible.
  * 
- * Shifts are not folded.
+ * Shifts are not folded, neither are divisions and remainders by zero or overflowing signed divisions.
  * 
  * @param inst the binary instruction
+ * @param VC the value and constant representation of the same binary instruction
+ * @param WL the worklist of the basic block
  * @return true if optimized, false otherwise
 */
-bool ConstantFolding (Instruction &inst)
+bool ConstantFolding (Instruction &inst, const ValAndConst &VC, LocalOptsWorklist &WL)
 {
-  ConstantInt *C1 = dyn_cast<ConstantInt>(inst.getOperand(0));
-  ConstantInt *C2 = dyn_cast<ConstantInt>(inst.getOperand(1));
+  if (VC.NConstants != 2)
+    return false;
+
+  // for commutative operations the constants may be swapped, which does not change the result
+  Constant *C1 = cast<Constant>(VC.Val);
+  Constant *C2 = VC.Const;
 
-  if (!C1 || !C2)
+  if (inst.getOpcode() == BinaryOperator::Add && (C1->isNullValue() || C2->isNullValue()))
     return false;
 
-  APInt fact1 = C1->getValue();
-  APInt fact2 = C2->getValue();
+  // vectors are folded lane by lane
+  SmallVector<APInt, 8> Lanes1, Lanes2;
+  getLanes(C1, Lanes1);
+  getLanes(C2, Lanes2);
 
-  switch (inst.getOpcode())
+  for (size_t i = 0; i < Lanes1.size(); i++)
   {
-    case BinaryOperator::Add:
-      if (C1->isZero() || C2->isZero())
-        return false;
-      fact1 += fact2;
-      break;
-    
-    case BinaryOperator::Sub:
-      fact1 -= fact2;
-      break;
+    APInt &fact1 = Lanes1[i];
+    const APInt &fact2 = Lanes2[i];
 
-    case BinaryOperator::Mul:
-      fact1 *= fact2;
-      break;
+    switch (inst.getOpcode())
+    {
+      case BinaryOperator::Add:
+        fact1 += fact2;
+        break;
+      
+      case BinaryOperator::Sub:
+        fact1 -= fact2;
+        break;
 
-    case BinaryOperator::SDiv:
-      fact1 = fact1.udiv(fact2);
-      break;
+      case BinaryOperator::Mul:
+        fact1 *= fact2;
+        break;
 
-    case BinaryOperator::UDiv:
-      fact1 = fact1.udiv(fact2);
-      break;
+      case BinaryOperator::SDiv:
+        if (fact2.isZero() || (fact1.isMinSignedValue() && fact2.isAllOnes()))
+          return false;
+        fact1 = fact1.sdiv(fact2);
+        break;
 
-    default:
-      return false;
+      case BinaryOperator::UDiv:
+        if (fact2.isZero())
+          return false;
+        fact1 = fact1.udiv(fact2);
+        break;
+
+      case BinaryOperator::SRem:
+        if (fact2.isZero() || (fact1.isMinSignedValue() && fact2.isAllOnes()))
+          return false;
+        fact1 = fact1.srem(fact2);
+        break;
+
+      case BinaryOperator::URem:
+        if (fact2.isZero())
+          return false;
+        fact1 = fact1.urem(fact2);
+        break;
+
+      default:
+        return false;
+    }
   }
 
-  ConstantInt *result = ConstantInt::get(C1->getType(), fact1.getZExtValue());
-  ConstantInt *zero = ConstantInt::get(C1->getType(), 0);
+  Constant *result = WL.getConstant(C1->getType(), Lanes1);
+  Constant *zero = WL.getConstant(C1->getType(), APInt(Lanes1.front().getBitWidth(), 0));
   // a dummy add instruction with second operand 0 is added, which will be optmized in subsequent steps
-  Instruction *addi = BinaryOperator::Create(Instruction::Add, result, zero);
+  Instruction *addi = WL.create(Instruction::Add, result, zero);
 
-  addi->insertAfter(&inst);
-  inst.replaceAllUsesWith(addi);
+  WL.insertAfter(addi, &inst);
+  WL.replaceAllUsesWith(inst, addi);
 
   return true;
 }
@@ -147,11 +458,12 @@ bool ConstantFolding (Instruction &inst)
  * 
  * @param inst the binary instruction
  * @param VC the value and constant representation of the same binary instruction
- * The function assumes at least a constant is present and in the right position, hence the pair VC,
- * which is derived from a getValAndConst call, always has the second element non-null
+ * The function assumes at least a constant is present and in the right position, hence VC,
+ * which is derived from a getValAndConst call, always has a non-null constant
+ * @param WL the worklist of the basic block
  * @return true if optimized, false otherwise
 */
-bool AlgebraicIdentity (Instruction &inst, std::pair<Value*, ConstantInt*> *VC)
+bool AlgebraicIdentity (Instruction &inst, const ValAndConst &VC, LocalOptsWorklist &WL)
 {
   bool ToReplace = false;
 
@@ -162,82 +474,544 @@ bool AlgebraicIdentity (Instruction &inst, std::pair<Value*, ConstantInt*> *VC)
     case BinaryOperator::Sub:
     case BinaryOperator::Shl:
     case BinaryOperator::LShr:
-      if (VC->second->getValue().isZero())
+      if (VC.Splat && VC.Splat->isZero())
         ToReplace = true;
       break;
     case BinaryOperator::Mul:
     case BinaryOperator::UDiv:
     case BinaryOperator::SDiv:
-      if (VC->second->getValue().isOne())
+      if (VC.Splat && VC.Splat->isOne())
         ToReplace = true;
       break;
   }
 
   // The Value type is necessary in order to include also the Argument objects (representig function's arguments).
   if(ToReplace)
-    inst.replaceAllUsesWith(VC->first);
+    WL.replaceAllUsesWith(inst, VC.Val);
   return ToReplace;
 }
 
+/**
+ * Latencies, in cycles, of the integer operations on a native register of the target.
+ * They are used to decide whether a sequence of cheaper instructions is faster than the instruction it replaces.
+*/
+struct ArithLatency
+{
+  unsigned Mul;
+  unsigned Div;
+  unsigned Add;
+  unsigned Shift;
+  // width of a native register, larger integers are split in several registers
+  unsigned RegisterBits;
+};
+
+/**
+ * Get the latencies of the integer operations for the target of a module.
+ * Targets without an entry in the table use generic latencies.
+ *
+ * @param M the module
+ * @return the latencies of the target
+*/
+ArithLatency getArithLatency (const Module &M)
+{
+  Triple T(M.getTargetTriple());
+  switch (T.getArch())
+  {
+    case Triple::x86:
+      return {3, 26, 1, 1, 32};
+    case Triple::x86_64:
+      return {3, 26, 1, 1, 64};
+    case Triple::arm:
+    case Triple::thumb:
+      return {3, 12, 1, 1, 32};
+    case Triple::aarch64:
+      return {4, 12, 1, 1, 64};
+    case Triple::riscv32:
+      return {4, 20, 1, 1, 32};
+    case Triple::riscv64:
+      return {4, 20, 1, 1, 64};
+    default:
+      return {4, 20, 1, 1, T.isArch64Bit() ? 64u : 32u};
+  }
+}
+
+/**
+ * Builder of a sequence of instructions replacing a single instruction: every new instruction is inserted after the
+ * previous one, starting right after the replaced instruction, so that the operands always dominate their uses.
+*/
+class SequenceBuilder
+{
+  LocalOptsWorklist &WL;
+  Instruction *Pos;
+
+public:
+  SequenceBuilder (LocalOptsWorklist &WL, Instruction &inst) : WL(WL), Pos(&inst) {}
+
+  Value *binOp (Instruction::BinaryOps Op, Value *V1, Value *V2)
+  {
+    Instruction *I = WL.create(Op, V1, V2);
+    WL.insertAfter(I, Pos);
+    Pos = I;
+    return I;
+  }
+
+  Value *cast (Instruction::CastOps Op, Value *V, unsigned BitWidth)
+  {
+    Instruction *I = WL.createCast(Op, V, BitWidth);
+    WL.insertAfter(I, Pos);
+    Pos = I;
+    return I;
+  }
+
+  /**
+   * Get an integer constant with the same type as V, splatted in every lane for vectors.
+  */
+  Constant *constant (Value *V, const APInt &C)
+  {
+    return WL.getConstant(V->getType(), C);
+  }
+
+  Constant *constant (Value *V, uint64_t C)
+  {
+    return constant(V, APInt(V->getType()->getScalarSizeInBits(), C));
+  }
+
+  /**
+   * Get an integer constant with the same type as V, with a value for each lane.
+  */
+  Constant *constant (Value *V, ArrayRef<APInt> Lanes)
+  {
+    return WL.getConstant(V->getType(), Lanes);
+  }
+};
+
+/**
+ * Get the non-adjacent form (NAF) of a constant, i.e. its canonical signed digit representation with digits in
+ * {-1, 0, 1}, in which no two adjacent digits are non-zero; among the signed digit representations it is the one
+ * with the least non-zero digits.
+ * The arithmetic is modulo 2^BitWidth, so a digit at position BitWidth is dropped: this way negative constants
+ * are represented as well (e.g. -1 is the single digit -1 at position 0).
+ *
+ * @param C the constant
+ * @param Digits the non-zero digits, as pairs of position and sign (true if negative), from the most significant
+*/
+void getNonAdjacentForm (const APInt &C, SmallVectorImpl<std::pair<unsigned, bool>> &Digits)
+{
+  unsigned BitWidth = C.getBitWidth();
+  // one more bit is needed, since rounding up the constant can carry in position BitWidth
+  APInt K = C.zext(BitWidth + 1);
+  for (unsigned pos = 0; !K.isZero(); pos++, K.lshrInPlace(1))
+  {
+    if (!K[0])
+      continue;
+    // the digit is chosen so that the remaining value is a multiple of 4, hence the next digit is zero
+    bool negative = K[1];
+    if (negative)
+      K += 1;
+    else
+      K -= 1;
+    if (pos < BitWidth)
+      Digits.push_back({pos, negative});
+  }
+  std::reverse(Digits.begin(), Digits.end());
+}
+
+/** @brief Lower a multiplication by a constant into shifts, additions and subtractions.
+ * Every non-zero digit of the non-adjacent form of the constant becomes a shifted copy of the value; the copies are
+ * summed pairwise, so that the sequence is as short and as shallow as possible.
+ * E.g. x * 30 => (x << 5) - (x << 1); x * -7 => x - (x << 3)
+ * The sequence is introduced only if its latency is lower than the latency of the multiplication on the target.
+ *
+ * @param inst the multiplication
+ * @param VC the value and constant representation of the same multiplication
+ * @param WL the worklist of the basic block
+ * @param Latency the latencies of the target
+ * @return the last instruction of the sequence, nullptr if the multiplication is not lowered
+*/
+Value *decomposeMul (Instruction &inst, const ValAndConst &VC, LocalOptsWorklist &WL, const ArithLatency &Latency)
+{
+  // lanes with different constants can only be lowered to a single shift, by a different amount in each lane
+  if (!VC.Splat)
+  {
+    SmallVector<APInt, 8> Log2s;
+    if (!getLog2Lanes(VC.Const, Log2s))
+      return nullptr;
+    SequenceBuilder SB(WL, inst);
+    return SB.binOp(Instruction::Shl, VC.Val, SB.constant(VC.Val, Log2s));
+  }
+
+  SmallVector<std::pair<unsigned, bool>, 8> Digits;
+  getNonAdjacentForm(*VC.Splat, Digits);
+
+  // the multiplication by zero is not a sequence
+  if (Digits.empty())
+    return nullptr;
+
+  // the shifts are independent, then the terms are summed pairwise in ceil(log2(terms)) levels
+  unsigned shifts = count_if(Digits, [] (const std::pair<unsigned, bool> &D) { return D.first != 0; });
+  bool negated = all_of(Digits, [] (const std::pair<unsigned, bool> &D) { return D.second; });
+  unsigned adds = Digits.size() - 1 + (negated ? 1 : 0);
+  unsigned parts = divideCeil(VC.Splat->getBitWidth(), Latency.RegisterBits);
+  unsigned seqLatency = parts * ((shifts ? Latency.Shift : 0) + Log2_32_Ceil(Digits.size()) * Latency.Add
+    + (negated ? Latency.Add : 0));
+  // the sequence must also not keep the target busier than the multiplication
+  unsigned seqWork = parts * (shifts * Latency.Shift + adds * Latency.Add);
+  // a multiplication wider than a register needs a multiplication for each couple of parts
+  unsigned mulLatency = parts * parts * Latency.Mul;
+  if (seqLatency >= mulLatency || seqWork > mulLatency)
+    return nullptr;
+
+  SequenceBuilder SB(WL, inst);
+
+  // terms to be summed, each one with its sign (true if it has to be subtracted)
+  SmallVector<std::pair<Value*, bool>, 8> Terms;
+  for (auto &D : Digits)
+  {
+    Value *term = VC.Val;
+    if (D.first)
+      term = SB.binOp(Instruction::Shl, VC.Val, SB.constant(VC.Val, D.first));
+    Terms.push_back({term, D.second});
+  }
+
+  while (Terms.size() > 1)
+  {
+    SmallVector<std::pair<Value*, bool>, 8> Sums;
+    for (size_t i = 0; i + 1 < Terms.size(); i += 2)
+    {
+      auto [V1, neg1] = Terms[i];
+      auto [V2, neg2] = Terms[i + 1];
+      if (neg1 == neg2)
+        // (-a) + (-b) is kept as -(a + b)
+        Sums.push_back({SB.binOp(Instruction::Add, V1, V2), neg1});
+      else if (neg2)
+        Sums.push_back({SB.binOp(Instruction::Sub, V1, V2), false});
+      else
+        Sums.push_back({SB.binOp(Instruction::Sub, V2, V1), false});
+    }
+    if (Terms.size() % 2)
+      Sums.push_back(Terms.back());
+    Terms = std::move(Sums);
+  }
+
+  auto [result, negative] = Terms.front();
+  if (negative)
+    result = SB.binOp(Instruction::Sub, SB.constant(result, 0), result);
+  return result;
+}
+
+/**
+ * Magic number of an unsigned division by a constant (see getUnsignedMagic).
+*/
+struct UnsignedMagic
+{
+  APInt Magic;
+  // true if the magic number does not fit in the type, hence the high product needs a fixup addition
+  bool IsAdd = false;
+  unsigned Shift;
+};
+
+/**
+ * Compute the magic number of an unsigned division by D (Granlund-Montgomery, Hacker's Delight 10-8), such that
+ * x / D == mulhu(x, Magic) >> Shift, or, when IsAdd, x / D == (((x - q) >> 1) + q) >> (Shift - 1) with
+ * q = mulhu(x, Magic).
+ * D must be greater than one.
+ *
+ * @param D the divisor
+ * @return the magic number and the shift
+*/
+UnsignedMagic getUnsignedMagic (const APInt &D)
+{
+  unsigned BitWidth = D.getBitWidth();
+  APInt AllOnes = APInt::getAllOnes(BitWidth);
+  APInt SignedMin = APInt::getSignedMinValue(BitWidth);
+  APInt SignedMax = APInt::getSignedMaxValue(BitWidth);
+
+  UnsignedMagic UM;
+  APInt NC = AllOnes - (AllOnes - D).urem(D);
+  unsigned p = BitWidth - 1;
+  APInt Q1 = SignedMin.udiv(NC);
+  APInt R1 = SignedMin - Q1 * NC;
+  APInt Q2 = SignedMax.udiv(D);
+  APInt R2 = SignedMax - Q2 * D;
+  APInt Delta;
+  do
+  {
+    p++;
+    if (R1.uge(NC - R1))
+    {
+      Q1 = Q1 + Q1 + 1;
+      R1 = R1 + R1 - NC;
+    }
+    else
+    {
+      Q1 = Q1 + Q1;
+      R1 = R1 + R1;
+    }
+    if ((R2 + 1).uge(D - R2))
+    {
+      if (Q2.uge(SignedMax))
+        UM.IsAdd = true;
+      Q2 = Q2 + Q2 + 1;
+      R2 = R2 + R2 + 1 - D;
+    }
+    else
+    {
+      if (Q2.uge(SignedMin))
+        UM.IsAdd = true;
+      Q2 = Q2 + Q2;
+      R2 = R2 + R2 + 1;
+    }
+    Delta = D - 1 - R2;
+  }
+  while (p < 2 * BitWidth && (Q1.ult(Delta) || (Q1 == Delta && R1.isZero())));
+
+  UM.Magic = Q2 + 1;
+  UM.Shift = p - BitWidth;
+  return UM;
+}
+
+/**
+ * Magic number of a signed division by a constant (see getSignedMagic).
+*/
+struct SignedMagic
+{
+  APInt Magic;
+  unsigned Shift;
+};
+
+/**
+ * Compute the magic number of a signed division by D (Granlund-Montgomery, Hacker's Delight 10-6), such that
+ * x / D == q + (q < 0) with q = (mulhs(x, Magic) + x * correction) >> Shift, where x is added when D > 0 and
+ * Magic < 0, and it is subtracted when D < 0 and Magic > 0.
+ * The absolute value of D must be greater than one.
+ *
+ * @param D the divisor
+ * @return the magic number and the shift
+*/
+SignedMagic getSignedMagic (const APInt &D)
+{
+  unsigned BitWidth = D.getBitWidth();
+  APInt SignedMin = APInt::getSignedMinValue(BitWidth);
+
+  APInt AD = D.abs();
+  APInt T = SignedMin + D.lshr(BitWidth - 1);
+  // absolute value of nc
+  APInt ANC = T - 1 - T.urem(AD);
+  unsigned p = BitWidth - 1;
+  APInt Q1 = SignedMin.udiv(ANC);
+  APInt R1 = SignedMin - Q1 * ANC;
+  APInt Q2 = SignedMin.udiv(AD);
+  APInt R2 = SignedMin - Q2 * AD;
+  APInt Delta;
+  do
+  {
+    p++;
+    Q1 <<= 1;
+    R1 <<= 1;
+    if (R1.uge(ANC))
+    {
+      Q1 += 1;
+      R1 -= ANC;
+    }
+    Q2 <<= 1;
+    R2 <<= 1;
+    if (R2.uge(AD))
+    {
+      Q2 += 1;
+      R2 -= AD;
+    }
+    Delta = AD - R2;
+  }
+  while (Q1.ult(Delta) || (Q1 == Delta && R1.isZero()));
+
+  SignedMagic SM;
+  SM.Magic = Q2 + 1;
+  if (D.isNegative())
+    SM.Magic = -SM.Magic;
+  SM.Shift = p - BitWidth;
+  return SM;
+}
+
+/**
+ * Emit the high half of the product of X and a magic number, through a multiplication on twice the width.
+ *
+ * @param SB the builder of the sequence
+ * @param X the value
+ * @param Magic the magic number
+ * @param isSigned true for a signed multiplication
+ * @return the high half of the product
+*/
+Value *emitMulHigh (SequenceBuilder &SB, Value *X, const APInt &Magic, bool isSigned)
+{
+  unsigned BitWidth = Magic.getBitWidth();
+  Value *wide = SB.cast(isSigned ? Instruction::SExt : Instruction::ZExt, X, 2 * BitWidth);
+  APInt wideMagic = isSigned ? Magic.sext(2 * BitWidth) : Magic.zext(2 * BitWidth);
+  Value *product = SB.binOp(Instruction::Mul, wide, SB.constant(wide, wideMagic));
+  Value *high = SB.binOp(Instruction::LShr, product, SB.constant(product, BitWidth));
+  return SB.cast(Instruction::Trunc, high, BitWidth);
+}
+
+/** @brief Lower a division or a remainder by a non-zero constant into multiplications, shifts and additions.
+ * - unsigned by a power of two: x / 2^k => x >> k; x % 2^k => x & (2^k - 1)
+ * - signed by a power of two: the dividend is biased by 2^k - 1 when negative, so that the shift rounds towards
+ *   zero: x / 2^k => (x + ((x >> (k - 1)) >>> (w - k))) >> k, negated when the divisor is negative
+ * - any other constant: the quotient is the high half of the product with a magic number, followed by a shift
+ *   and by the fixups of the sign (see getUnsignedMagic, getSignedMagic)
+ * A remainder is computed as x - (x / c) * c, where the multiplication is lowered afterwards by decomposeMul.
+ * The sequence is introduced only if its latency is lower than the latency of the division on the target.
+ *
+ * @param inst the division or remainder
+ * @param VC the value and constant representation of the same instruction
+ * @param WL the worklist of the basic block
+ * @param Latency the latencies of the target
+ * @return the last instruction of the sequence, nullptr if the instruction is not lowered
+*/
+Value *lowerDivision (Instruction &inst, const ValAndConst &VC, LocalOptsWorklist &WL, const ArithLatency &Latency)
+{
+  unsigned opcode = inst.getOpcode();
+  bool isSigned = (opcode == BinaryOperator::SDiv || opcode == BinaryOperator::SRem);
+  bool isRem = (opcode == BinaryOperator::URem || opcode == BinaryOperator::SRem);
+  Value *X = VC.Val;
+
+  // divisions of constants are left to constant folding
+  if (isa<Constant>(X))
+    return nullptr;
+
+  SequenceBuilder SB(WL, inst);
+
+  // lanes with different constants can only be lowered to a single shift or mask, when unsigned
+  if (!VC.Splat)
+  {
+    SmallVector<APInt, 8> Log2s;
+    if (isSigned || !getLog2Lanes(VC.Const, Log2s))
+      return nullptr;
+    if (!isRem)
+      return SB.binOp(Instruction::LShr, X, SB.constant(X, Log2s));
+    SmallVector<APInt, 8> Masks;
+    for (const APInt &Log2 : Log2s)
+      Masks.push_back(APInt::getLowBitsSet(Log2.getBitWidth(), Log2.getZExtValue()));
+    return SB.binOp(Instruction::And, X, SB.constant(X, Masks));
+  }
+
+  const APInt &D = *VC.Splat;
+  unsigned BitWidth = D.getBitWidth();
+
+  // divisions by zero are undefined
+  if (D.isZero())
+    return nullptr;
+
+  // x % 1 == 0, x / 1 is an algebraic identity
+  if (D.isOne() || (isSigned && D.isAllOnes()))
+    return isRem ? SB.constant(X, 0) : (D.isOne() ? nullptr : SB.binOp(Instruction::Sub, SB.constant(X, 0), X));
+
+  if (!isSigned && D.isPowerOf2())
+  {
+    if (isRem)
+      return SB.binOp(Instruction::And, X, SB.constant(X, D - 1));
+    return SB.binOp(Instruction::LShr, X, SB.constant(X, D.logBase2()));
+  }
+
+  unsigned parts = divideCeil(BitWidth, Latency.RegisterBits);
+  unsigned add = parts * Latency.Add;
+  unsigned shift = parts * Latency.Shift;
+  unsigned mulHigh = parts * parts * Latency.Mul + shift;
+  unsigned seqLatency = isRem ? parts * parts * Latency.Mul + add : 0;
+
+  bool isPowerOf2 = isSigned && D.abs().isPowerOf2();
+  UnsignedMagic UM;
+  SignedMagic SM;
+  if (isPowerOf2)
+    seqLatency += 3 * shift + add + (D.isNegative() ? add : 0);
+  else if (!isSigned)
+  {
+    UM = getUnsignedMagic(D);
+    seqLatency += mulHigh + (UM.IsAdd ? 2 * add + shift : 0) + shift;
+  }
+  else
+  {
+    SM = getSignedMagic(D);
+    seqLatency += mulHigh + add + 2 * shift + add;
+  }
+
+  if (seqLatency >= parts * parts * Latency.Div)
+    return nullptr;
+
+  Value *Q;
+  if (isPowerOf2)
+  {
+    unsigned k = D.abs().logBase2();
+    Value *sign = k > 1 ? SB.binOp(Instruction::AShr, X, SB.constant(X, k - 1)) : X;
+    Value *bias = SB.binOp(Instruction::LShr, sign, SB.constant(X, BitWidth - k));
+    Q = SB.binOp(Instruction::AShr, SB.binOp(Instruction::Add, X, bias), SB.constant(X, k));
+    if (D.isNegative())
+      Q = SB.binOp(Instruction::Sub, SB.constant(X, 0), Q);
+  }
+  else if (!isSigned)
+  {
+    Q = emitMulHigh(SB, X, UM.Magic, false);
+    unsigned s = UM.Shift;
+    if (UM.IsAdd)
+    {
+      Value *T = SB.binOp(Instruction::LShr, SB.binOp(Instruction::Sub, X, Q), SB.constant(X, 1));
+      Q = SB.binOp(Instruction::Add, T, Q);
+      s--;
+    }
+    if (s)
+      Q = SB.binOp(Instruction::LShr, Q, SB.constant(X, s));
+  }
+  else
+  {
+    Q = emitMulHigh(SB, X, SM.Magic, true);
+    if (D.isStrictlyPositive() && SM.Magic.isNegative())
+      Q = SB.binOp(Instruction::Add, Q, X);
+    else if (D.isNegative() && SM.Magic.isStrictlyPositive())
+      Q = SB.binOp(Instruction::Sub, Q, X);
+    if (SM.Shift)
+      Q = SB.binOp(Instruction::AShr, Q, SB.constant(X, SM.Shift));
+    // add one to negative quotients, to round towards zero
+    Value *negative = SB.binOp(Instruction::LShr, Q, SB.constant(X, BitWidth - 1));
+    Q = SB.binOp(Instruction::Add, Q, negative);
+  }
+
+  if (!isRem)
+    return Q;
+  Value *multiple = SB.binOp(Instruction::Mul, Q, SB.constant(X, D));
+  return SB.binOp(Instruction::Sub, X, multiple);
+}
+
 /** @brief Apply strength reduction optmization on a binary instruction and susbtitute the instruction uses,
  * if possible.
- * In case of multiplication and in case of divisions where the constant is a power of two,
- * a shift is inserted, followed by eventual needed multiplications (to be optimized in the following stages) and subtractions.
+ * In case of multiplication, the constant is decomposed in a sequence of shifts, additions and subtractions,
+ * whenever the target executes it faster than the multiplication (see decomposeMul); in case of divisions and
+ * remainders, signed or unsigned, the constant is turned into a multiplication by a magic number followed by
+ * shifts, or into shifts only for powers of two (see lowerDivision).
  * 
  * @param inst the binary instruction
  * @param VC the value and constant representation of the same binary instruction
+ * @param WL the worklist of the basic block
+ * @param Latency the latencies of the target
  * @return true if optimized, false otherwise
 */
-bool StrengthReduction (Instruction &inst, std::pair<Value*, ConstantInt*> *VC)
+bool StrengthReduction (Instruction &inst, const ValAndConst &VC, LocalOptsWorklist &WL, const ArithLatency &Latency)
 {
-  // Negative constants are not handled
-  unsigned int shiftVal = VC->second->getValue().ceilLogBase2();
-  ConstantInt *shift = ConstantInt::get(VC->second->getType(), shiftVal);
-
-  // Last instruction to be inserted
-  Instruction* lastinst = nullptr;
+  // Last value computed by the inserted instructions
+  Value *lastinst = nullptr;
   switch (inst.getOpcode())
   {
     case BinaryOperator::Mul:
-    {
-      Instruction *shli = BinaryOperator::Create(Instruction::Shl, VC->first, shift);
-      shli->insertAfter(&inst);
-      unsigned int restVal = (1 << shiftVal) - VC->second->getValue().getZExtValue();
-      ConstantInt *rest = ConstantInt::get(VC->second->getType(), restVal);
-
-      if (restVal == 0)
-      {
-        lastinst = shli;
-      }
-      else if (restVal == 1)
-      {
-        lastinst = BinaryOperator::Create(BinaryOperator::Sub, shli, VC->first);
-        lastinst->insertAfter(shli);
-      }
-      // if rest is > 1 an intermediate multiplication is needed
-      else if (restVal > 1)
-      {
-        Instruction *muli = BinaryOperator::Create(BinaryOperator::Mul, VC->first, rest);
-        muli->insertAfter(shli);
-        lastinst = BinaryOperator::Create(BinaryOperator::Sub, shli, muli);
-        lastinst->insertAfter(muli);
-      }
+      lastinst = decomposeMul(inst, VC, WL, Latency);
       break;
-    }
 
     case BinaryOperator::UDiv:
-    {
-      if (VC->second->getValue().isPowerOf2())
-      {
-        lastinst = BinaryOperator::Create(Instruction::LShr, VC->first, shift);
-        lastinst->insertAfter(&inst);
-      }
+    case BinaryOperator::SDiv:
+    case BinaryOperator::URem:
+    case BinaryOperator::SRem:
+      lastinst = lowerDivision(inst, VC, WL, Latency);
       break;
-    }
   }
 
   if (lastinst)
-    inst.replaceAllUsesWith(lastinst);
+    WL.replaceAllUsesWith(inst, lastinst);
   // if lastinst is nullptr (e.g. strength reduction has not been adopted), it returns false, otherwise true
   return lastinst;
 }
@@ -252,107 +1026,409 @@ bool StrengthReduction (Instruction &inst, std::pair<Value*, ConstantInt*> *VC)
  * 
  * @param inst the binary instruction
  * @param VC the value and constant representation of the same binary instruction
- * @return Reference to the operand of the examined operation which is not constant.
+ * @param WL the worklist of the basic block
+ * @return true if optimized, false otherwise
 */
-bool MultiInstructionOpt (Instruction &inst, std::pair<Value*, ConstantInt*> *VC)
+bool MultiInstructionOpt (Instruction &inst, const ValAndConst &VC, LocalOptsWorklist &WL)
 {
+  // operations without an opposite operation (e.g. signed divisions) cannot be cancelled
+  auto opposite = oppositeOp.find(static_cast<BinaryOperator::BinaryOps>(inst.getOpcode()));
+  if (opposite == oppositeOp.end())
+    return false;
+  // the bits shifted or multiplied out of the value cannot be restored, unless the operation does not wrap
+  if ((inst.getOpcode() == Instruction::Mul || inst.getOpcode() == Instruction::Shl) && !inst.hasNoUnsignedWrap())
+    return false;
+
   for (auto &use : inst.uses())
   {
     Instruction *User = dyn_cast<Instruction>(use.getUser());
     if (!User || !User->isBinaryOp())
       continue;
 
-    std::pair<Value*, ConstantInt*> *VCUser = getValAndConst(*User);
+    ValAndConst VCUser = getValAndConst(*User);
 
-    if (!VCUser->second 
-      || (VCUser->second->getValue() != VC->second->getValue()) 
-      || (oppositeOp.at(static_cast<BinaryOperator::BinaryOps>(inst.getOpcode())) != User->getOpcode()))
+    if (!VCUser.Const 
+      || (VCUser.Const != VC.Const) 
+      || (opposite->second != User->getOpcode()))
       continue;
 
-    User->replaceAllUsesWith(VC->first);
+    WL.replaceAllUsesWith(*User, VC.Val);
     return true;
   }
 
   return false;
 }
 
-bool runOnBasicBlock(BasicBlock &B) 
+/**
+ * Get the factors a shift left by a constant multiplies each lane by.
+ *
+ * @param inst the shift instruction
+ * @param Factors the factors of the lanes
+ * @return false if the shift amount is not a constant lower than the bit width in every lane, true otherwise
+*/
+bool getShlFactors (Instruction &inst, SmallVectorImpl<APInt> &Factors)
 {
-  // map that tracks "dead code", namely instructions that have no more uses
-  std::unordered_set<Instruction*> DeadCode;
-  // flag tracking if in one single cycle on all the instructions of the block at least one optmization is done
-  bool Transformed = false;
-  // flag tracking is at least one optmization has been done in the whole exectution of the current function
-  bool TransformedGlobal = false;
+  Constant *C = getIntConstant(inst.getOperand(1));
+  if (!C)
+    return false;
+  getLanes(C, Factors);
+  for (APInt &Factor : Factors)
+  {
+    if (Factor.uge(Factor.getBitWidth()))
+      return false;
+    Factor = APInt::getOneBitSet(Factor.getBitWidth(), Factor.getZExtValue());
+  }
+  return true;
+}
 
-  do
+/**
+ * Get the associative and commutative operation of a binary instruction, as a node of a reassociated expression
+ * tree: subtractions are additions of negated operands and shifts left by a constant are multiplications by a
+ * power of two.
+ *
+ * @param inst the binary instruction
+ * @return the operation, Instruction::BinaryOpsEnd if the instruction cannot be reassociated
+*/
+Instruction::BinaryOps getAssociativeOp (Instruction &inst)
+{
+  Type *Ty = inst.getType();
+  if (!inst.isBinaryOp() || !Ty->isIntOrIntVectorTy() || isa<ScalableVectorType>(Ty))
+    return Instruction::BinaryOpsEnd;
+
+  switch (inst.getOpcode())
   {
-    Transformed = false;
-    // cycle all the instruction of the basic block
-    for (auto &inst : B) 
+    case Instruction::Add:
+    case Instruction::Sub:
+      return Instruction::Add;
+
+    case Instruction::Shl:
     {
-      // check if the current operation is binary
-      if (!inst.isBinaryOp())
-        continue;
-      
-      // if the binary instruction has no constants no optmization is possible
-      size_t nConstants = getNConstants(inst);
-      if (nConstants == 0)
-        continue;
-
-      // get a Value - Constant representation of the operation
-      std::pair<Value*, ConstantInt*> *VC = getValAndConst(inst);
-      /* the following check is needed to skip ensure there is a constant
-      * in the "right" position.
-      * e.g. %10 = 3 - %5
-      */
-      if (!VC->second)
-        continue;
-
-      /* check if the instruction is used and try all the optimizations in the following order:
-      *  - algebraic identity
-      *  - constant folding (only when constants are 2)
-      *  - multi instruction
-      *  - strength reduction
-      *  Algebraic identity must be tried before constant folding to avoid folding instructions with identities, which
-      *  are useless; strength reduction must be tried last, since optmizing multiplications and divisions with multi
-      *  instruction allows to eliminate useless multiplication/divisions, which would be otherwise optmized with shifts
-      */
-      bool TransformedLocal = (!inst.getNumUses())
-        || AlgebraicIdentity(inst, VC)
-        || (nConstants == 2 && ConstantFolding(inst))
-        || MultiInstructionOpt(inst, VC)
-        || StrengthReduction(inst, VC);
-
-      // if, after optmizations, an instruction has no uses, it's dead code
-      if (!inst.getNumUses())
+      SmallVector<APInt, 4> Factors;
+      return getShlFactors(inst, Factors) ? Instruction::Mul : Instruction::BinaryOpsEnd;
+    }
+
+    case Instruction::Mul:
+    case Instruction::And:
+    case Instruction::Or:
+    case Instruction::Xor:
+      return static_cast<Instruction::BinaryOps>(inst.getOpcode());
+
+    default:
+      return Instruction::BinaryOpsEnd;
+  }
+}
+
+/**
+ * Check if an instruction is an inner node of the expression tree of its user, i.e. its only user is in the same
+ * block and has the same associative operation; an inner node is rewritten together with the root of its tree.
+ *
+ * @param inst the instruction
+ * @return true if inst is an inner node, false if it is the root of a tree or it cannot be reassociated
+*/
+bool isInnerNode (Instruction &inst)
+{
+  Instruction::BinaryOps Op = getAssociativeOp(inst);
+  if (Op == Instruction::BinaryOpsEnd || !inst.hasOneUse())
+    return false;
+
+  Use &U = *inst.use_begin();
+  Instruction *User = dyn_cast<Instruction>(U.getUser());
+  // the amount of a shift is not an operand of the multiplication
+  return User && User->getParent() == inst.getParent() && getAssociativeOp(*User) == Op
+    && !(User->getOpcode() == Instruction::Shl && U.getOperandNo() == 1);
+}
+
+/**
+ * Expression tree of an associative and commutative operation, flattened by linearizeTree.
+*/
+struct AssociativeTree
+{
+  Instruction::BinaryOps Op;
+  // the leaves which are not constants, in the order of the tree, with their sign (true if negated, additions only)
+  SmallVector<std::pair<Value*, bool>, 8> Leaves;
+  // the constant leaves merged in a single value, lane by lane
+  SmallVector<APInt, 4> Const;
+  // number of instructions of the tree
+  unsigned NInstructions = 0;
+};
+
+/**
+ * Merge a constant leaf in the constant of a tree.
+ *
+ * @param T the tree
+ * @param Lanes the values of the lanes of the constant
+ * @param Negated true if the constant is subtracted
+*/
+void mergeConstant (AssociativeTree &T, ArrayRef<APInt> Lanes, bool Negated)
+{
+  for (size_t i = 0; i < Lanes.size(); i++)
+  {
+    switch (T.Op)
+    {
+      case Instruction::Add:
+        if (Negated)
+          T.Const[i] -= Lanes[i];
+        else
+          T.Const[i] += Lanes[i];
+        break;
+      case Instruction::Mul:
+        T.Const[i] *= Lanes[i];
+        break;
+      case Instruction::And:
+        T.Const[i] &= Lanes[i];
+        break;
+      case Instruction::Or:
+        T.Const[i] |= Lanes[i];
+        break;
+      default:
+        T.Const[i] ^= Lanes[i];
+        break;
+    }
+  }
+}
+
+/**
+ * Flatten the expression tree rooted at a binary instruction: the tree includes the inner nodes with the same
+ * associative operation, and its leaves are the other operands.
+ *
+ * @param Root the root of the tree
+ * @param T the flattened tree
+*/
+void linearizeTree (Instruction &Root, AssociativeTree &T)
+{
+  Type *Ty = Root.getType();
+  unsigned BitWidth = Ty->getScalarSizeInBits();
+  auto *VTy = dyn_cast<FixedVectorType>(Ty);
+
+  T.Op = getAssociativeOp(Root);
+  APInt Identity = T.Op == Instruction::Mul ? APInt(BitWidth, 1)
+    : T.Op == Instruction::And ? APInt::getAllOnes(BitWidth) : APInt(BitWidth, 0);
+  T.Const.assign(VTy ? VTy->getNumElements() : 1, Identity);
+
+  // the second operand is pushed first, so that the leaves are found from left to right
+  SmallVector<std::pair<Value*, bool>, 16> Stack = {{&Root, false}};
+  while (!Stack.empty())
+  {
+    auto [V, Negated] = Stack.pop_back_val();
+    Instruction *I = dyn_cast<Instruction>(V);
+
+    if (I && (I == &Root || isInnerNode(*I)))
+    {
+      T.NInstructions++;
+      switch (I->getOpcode())
       {
-        DeadCode.insert(&inst);
+        case Instruction::Sub:
+          Stack.push_back({I->getOperand(1), !Negated});
+          Stack.push_back({I->getOperand(0), Negated});
+          break;
+
+        case Instruction::Shl:
+        {
+          SmallVector<APInt, 4> Factors;
+          getShlFactors(*I, Factors);
+          mergeConstant(T, Factors, false);
+          Stack.push_back({I->getOperand(0), Negated});
+          break;
+        }
+
+        default:
+          Stack.push_back({I->getOperand(1), Negated});
+          Stack.push_back({I->getOperand(0), Negated});
+          break;
       }
+      continue;
+    }
 
-      Transformed = Transformed || TransformedLocal;
+    if (Constant *C = getIntConstant(V))
+    {
+      SmallVector<APInt, 4> Lanes;
+      getLanes(C, Lanes);
+      mergeConstant(T, Lanes, Negated);
     }
+    else
+      T.Leaves.push_back({V, Negated});
+  }
+}
+
+/**
+ * A term of a reassociated expression tree.
+*/
+struct ReassociatedTerm
+{
+  Value *V;
+  // true if the term is subtracted (additions only)
+  bool Negated;
+  // number of times the term is added (additions only)
+  unsigned Times;
+};
+
+/** @brief Reassociate the expression tree rooted at a binary instruction, if it can be computed with fewer
+ * instructions.
+ * Additions and subtractions, multiplications and shifts left by constants, and bitwise operations are flattened in
+ * the list of their leaves; all the constant leaves are merged in a single constant, and the leaves cancelling each
+ * other are removed (x - x, x ^ x, x & x, x | x); a term added more than once is multiplied by its occurrences.
+ * The remaining leaves are sorted by rank, so that the rewritten tree is deterministic, and combined from left to
+ * right with the constant as last operand (e.g. ((x + 3) + 5) - 7 -> x + 1, (x << 2) << 3 -> x * 32).
+ * The tree is rewritten only when it shrinks, hence the optimization does not undo strength reduction.
+ *
+ * @param inst the binary instruction
+ * @param WL the worklist of the basic block
+ * @return true if optimized, false otherwise
+*/
+bool Reassociation (Instruction &inst, LocalOptsWorklist &WL)
+{
+  // inner nodes are reassociated together with the root of their tree
+  if (getAssociativeOp(inst) == Instruction::BinaryOpsEnd || isInnerNode(inst))
+    return false;
+
+  AssociativeTree T;
+  linearizeTree(inst, T);
+  stable_sort(T.Leaves, [&WL] (const std::pair<Value*, bool> &L1, const std::pair<Value*, bool> &L2)
+    { return WL.getRank(L1.first) < WL.getRank(L2.first); });
 
-    // dead code elimination
-    if (DeadCode.size() > 0)
+  // occurrences of each leaf, where the negated ones count -1
+  DenseMap<Value*, int> Occurrences;
+  for (auto &[V, Negated] : T.Leaves)
+    Occurrences[V] += Negated ? -1 : 1;
+
+  // the remaining terms; in additions a term occurring more than once is multiplied by its occurrences
+  SmallVector<ReassociatedTerm, 8> Terms;
+  for (auto &Leaf : T.Leaves)
+  {
+    auto It = Occurrences.find(Leaf.first);
+    if (It == Occurrences.end())
+      continue;
+    int N = It->second;
+    Occurrences.erase(It);
+
+    if (T.Op == Instruction::Add && N)
+      Terms.push_back({Leaf.first, N < 0, static_cast<unsigned>(std::abs(N))});
+    else if (T.Op == Instruction::Mul)
+      Terms.append(N, {Leaf.first, false, 1});
+    else if (T.Op != Instruction::Add && (T.Op != Instruction::Xor || N % 2))
+      Terms.push_back({Leaf.first, false, 1});
+  }
+
+  // a constant absorbing all the lanes makes the tree constant (x * 0, x & 0, x | -1)
+  auto isAbsorbing = [&T] (const APInt &C)
+    { return T.Op == Instruction::Or ? C.isAllOnes() : (T.Op == Instruction::Mul || T.Op == Instruction::And) && C.isZero(); };
+  if (all_of(T.Const, isAbsorbing))
+    Terms.clear();
+
+  auto isIdentity = [&T] (const APInt &C)
+    { return T.Op == Instruction::Mul ? C.isOne() : T.Op == Instruction::And ? C.isAllOnes() : C.isZero(); };
+  bool HasConst = !Terms.empty() && !all_of(T.Const, isIdentity);
+  auto First = find_if(Terms, [] (const ReassociatedTerm &Term) { return !Term.Negated; });
+
+  // a tree without positive terms starts from the constant, or from zero
+  unsigned NInstructions = Terms.empty() ? 0
+    : Terms.size() - 1 + ((HasConst || First == Terms.end()) ? 1 : 0)
+      + count_if(Terms, [] (const ReassociatedTerm &Term) { return Term.Times > 1; });
+  if (NInstructions >= T.NInstructions)
+    return false;
+
+  Constant *C = WL.getConstant(inst.getType(), T.Const);
+  Value *Result = C;
+  if (!Terms.empty())
+  {
+    SequenceBuilder SB(WL, inst);
+    auto getTerm = [&SB] (const ReassociatedTerm &Term)
+      { return Term.Times > 1 ? SB.binOp(Instruction::Mul, Term.V, SB.constant(Term.V, Term.Times)) : Term.V; };
+
+    if (First != Terms.end())
     {
-      for (auto &inst : DeadCode)
-        inst->eraseFromParent();
-      DeadCode.clear();
+      Result = getTerm(*First);
+      Terms.erase(First);
     }
+    else
+      HasConst = false;
 
-    TransformedGlobal = TransformedGlobal || Transformed;
+    for (const ReassociatedTerm &Term : Terms)
+      Result = SB.binOp(Term.Negated ? Instruction::Sub : T.Op, Result, getTerm(Term));
+    if (HasConst)
+      Result = SB.binOp(T.Op, Result, C);
+  }
+
+  WL.replaceAllUsesWith(inst, Result);
+  return true;
+}
+
+/** @brief Apply the local optimizations on a basic block until a fixpoint is reached.
+ * The binary instructions of the block seed a worklist; after each rewrite only the users of the replaced
+ * instruction, the newly inserted instructions and the operands of the erased instructions are visited again,
+ * instead of rescanning the whole block.
+ *
+ * @param B the basic block
+ * @param WL the worklist of the worker optimizing the block
+ * @param Latency the latencies of the target
+ * @return true if at least one optimization has been applied, false otherwise
+*/
+bool runOnBasicBlock(BasicBlock &B, LocalOptsWorklist &WL, const ArithLatency &Latency) 
+{
+  WL.reset(B);
+  // flag tracking if at least one optimization has been done in the whole execution on the current block
+  bool TransformedGlobal = false;
+
+  // the block is pushed in reverse order, so that instructions are popped in program order
+  for (auto &inst : reverse(B))
+    WL.push(&inst);
+
+  while (Instruction *I = WL.pop())
+  {
+    Instruction &inst = *I;
+
+    // get a Value - Constant representation of the operation
+    ValAndConst VC = getValAndConst(inst);
+
+    /* the optimizations but reassociation need a constant in the "right" position, which is not the case when
+    * the binary instruction has no constants or e.g. for %10 = 3 - %5
+    */
+    bool HasConst = VC.Const != nullptr;
+
+    /* check if the instruction is used and try all the optimizations in the following order:
+    *  - algebraic identity
+    *  - constant folding (only when constants are 2)
+    *  - multi instruction
+    *  - reassociation
+    *  - strength reduction
+    *  Algebraic identity must be tried before constant folding to avoid folding instructions with identities, which
+    *  are useless; strength reduction must be tried last, since optmizing multiplications and divisions with multi
+    *  instruction and reassociation allows to eliminate useless multiplication/divisions, which would be otherwise
+    *  optmized with shifts
+    */
+    bool TransformedLocal = (!inst.getNumUses())
+      || (HasConst && AlgebraicIdentity(inst, VC, WL))
+      || (HasConst && ConstantFolding(inst, VC, WL))
+      || (HasConst && MultiInstructionOpt(inst, VC, WL))
+      || Reassociation(inst, WL)
+      || (HasConst && StrengthReduction(inst, VC, WL, Latency));
+
+    // if, after optmizations, an instruction has no uses, it's dead code
+    if (!inst.getNumUses())
+      WL.eraseFromParent(inst);
+
+    TransformedGlobal = TransformedGlobal || TransformedLocal;
   }
-  while (Transformed);
 
   return TransformedGlobal;
 }
 
-bool runOnFunction(Function &F) {
+/** @brief Apply the local optimizations on all the basic blocks of a function.
+ *
+ * @param F the function
+ * @param ContextLock lock serializing the changes to the LLVMContext, nullptr if no other function is optimized
+ * concurrently
+ * @return true if at least one optimization has been applied, false otherwise
+*/
+bool runOnFunction(Function &F, std::mutex *ContextLock) {
   bool Transformed = false;
+  // the scratch state is owned by the worker and reused for all the blocks
+  LocalOptsWorklist WL(ContextLock);
+  ArithLatency Latency = getArithLatency(*F.getParent());
+  WL.rank(F);
 
   for (auto Iter = F.begin(); Iter != F.end(); ++Iter) {
-    if (runOnBasicBlock(*Iter)) {
+    if (runOnBasicBlock(*Iter, WL, Latency)) {
       Transformed = true;
     }
   }
@@ -361,9 +1437,48 @@ bool runOnFunction(Function &F) {
 }
 
 PreservedAnalyses LocalOpts::run(Module &M, ModuleAnalysisManager &AM) {
-  for (auto Fiter = M.begin(); Fiter != M.end(); ++Fiter)
-    if (runOnFunction(*Fiter))
-      return PreservedAnalyses::none();
+  FunctionAnalysisManager &FAM = AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  SmallVector<Function*> Functions;
+  for (Function &F : M)
+    if (!F.isDeclaration())
+      Functions.push_back(&F);
+
+  // one flag per function, each one written only by the worker optimizing that function
+  std::vector<char> Transformed(Functions.size(), false);
 
-  return PreservedAnalyses::all();
-}
\ No newline at end of file
+  if (LocalOptsThreads == 1 || Functions.size() <= 1)
+  {
+    for (size_t i = 0; i < Functions.size(); i++)
+      Transformed[i] = runOnFunction(*Functions[i], nullptr);
+  }
+  else
+  {
+    // the optimizations are block-local, hence functions are independent apart from the shared LLVMContext
+    std::mutex ContextLock;
+    ThreadPool Pool(hardware_concurrency(LocalOptsThreads));
+    for (size_t i = 0; i < Functions.size(); i++)
+      Pool.async([&, i] { Transformed[i] = runOnFunction(*Functions[i], &ContextLock); });
+    Pool.wait();
+  }
+
+  // only the instructions inside the blocks change, so the CFG analyses of every function are preserved,
+  // while the other analyses are invalidated only for the transformed functions
+  bool TransformedAny = false;
+  PreservedAnalyses FunctionPA;
+  FunctionPA.preserveSet<CFGAnalyses>();
+  for (size_t i = 0; i < Functions.size(); i++)
+  {
+    if (!Transformed[i])
+      continue;
+    FAM.invalidate(*Functions[i], FunctionPA);
+    TransformedAny = true;
+  }
+
+  if (!TransformedAny)
+    return PreservedAnalyses::all();
+
+  PreservedAnalyses PA;
+  PA.preserve<FunctionAnalysisManagerModuleProxy>();
+  return PA;
+}